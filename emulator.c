@@ -36,34 +36,98 @@
    ********************************************************************* */
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
+#include <limits.h>
+#include <math.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#ifdef PARALLEL
+#include <stdint.h>
+#include <pthread.h>
+#include <sched.h>
+#endif
+#if defined(CHECKPOINT) || defined(REGRESS) || defined(TUNE)
+#include <sys/types.h>
+#include <sys/wait.h>
+#endif
 #include "emulator.h"
 #include "gbn.h"
 
+/* in the parallel build (-DPARALLEL -pthread) each thread has its own
+   event list and clock, see PARALLEL EXECUTION below */
+#ifdef PARALLEL
+#define THREADLOCAL __thread
+#if BIDIRECTIONAL
+#error "the parallel build needs all messages from layer 5 to arrive at A"
+#endif
+#else
+#define THREADLOCAL
+#endif
+
 struct event {
   float evtime;           /* event time */
   int evtype;             /* event type code */
   int eventity;           /* entity where event occurs */
   struct pkt *pktptr;     /* ptr to packet (if any) assoc w/ this event */
+  float evcreated;        /* time the event was scheduled */
+  int evcreator;          /* entity that scheduled the event */
+#ifdef FEC
+  int fecgroup;           /* FEC header of a packet: its group and its */
+  int fecslot;            /* slot in the group, minus the group size for the parity */
+#endif
+#ifdef SCENARIO
+  int episode;            /* scenario episode starting or ending */
+#endif
+#ifdef MULTIPATH
+  int path;               /* path a packet came on */
+  int pathseq;            /* and its number in the order sent */
+#endif
   struct event *prev;
   struct event *next;
 };
 
-struct event *evlist = NULL;   /* the event list */
+THREADLOCAL struct event *evlist = NULL;   /* the event list */
 
 /* possible events: */
 #define  TIMER_INTERRUPT 0  
 #define  FROM_LAYER5     1
 #define  FROM_LAYER3     2
+#define  FEC_DEADLINE    3    /* close A's FEC group early, see FORWARD ERROR CORRECTION */
+#define  EPISODE         4    /* a scenario episode starts or ends, see SCENARIOS */
+#define  APP_READ        5    /* B's application reads a message, see FLOWCONTROL */
+#define  RESEQ_DEADLINE  6    /* stop waiting for a packet B misses, see MULTIPATH */
 
 #define  OFF             0
 #define  ON              1
 
+/* arrival processes for messages from layer 5, chosen at compile time
+   with -DARRIVALS=<n> so the prompts of the default build do not change */
+#define  UNIFORM_ARRIVALS 0   /* gaps uniform on [0,2*lambda] */
+#define  POISSON_ARRIVALS 1   /* exponential gaps with mean lambda */
+#define  ONOFF_ARRIVALS   2   /* Poisson bursts separated by idle periods */
+#define  TRACE_ARRIVALS   3   /* replay arrival times from a trace file */
+#define  SATURATED_ARRIVALS 4 /* always a message ready, whenever A has room */
+
+#ifndef ARRIVALS
+#define ARRIVALS UNIFORM_ARRIVALS
+#endif
+
+/* number of messages handed to the sender by each arrival event.  With
+   more than one the whole burst is passed to A_outputv() in one call */
+#ifndef BURSTSIZE
+#define BURSTSIZE 1
+#endif
+
 int TRACE = 3;
 
 /* statistics updated by GBN */
 int window_full;   /* count of the number of messages dropped due to full window */
 int total_ACKs_received;
 int packets_resent;       /* count of the number of packets resent  */
+int fast_retransmits;     /* count of the packets resent on duplicate ACKs */
+int window_probes;        /* count of the packets sent into a closed receive window */
 int new_ACKs;           /* count of the number of acks correctly received */
 int packets_received;  /* count of the packets received by receiver */
 
@@ -76,14 +140,100 @@ static int messages_delivered;
 
 static int nsim = 0;              /* number of messages from 5 to 4 so far */ 
 static int nsimmax = 0;           /* number of msgs to generate, then stop */
-static float time = 0.000;
+static THREADLOCAL float simtime = 0.000;
+static THREADLOCAL int curentity = A;  /* entity whose event is being run */
 static float lossprob;            /* probability that a packet is dropped  */
 static float corruptprob;   /* probability that one bit is packet is flipped */
 static int corruptdirection; /* A->B A<-B or bidirectional corruption/loss */
 static float lambda;        /* arrival rate of messages from layer 5 */   
-static int   ntolayer3;           /* number sent into layer 3 */
-static int   nlost;               /* number lost in media */
-static int ncorrupt;              /* number corrupted by media*/
+static int   ntolayer3[2];        /* number sent into layer 3 by A and B */
+static int   nlost[2];            /* number lost in media */
+static int ncorrupt[2];           /* number corrupted by media*/
+static float lastarrival[2];      /* latest arrival time of a packet sent to A and B */
+static double linkbusy[2];        /* time the medium to A and B has spent carrying packets */
+static unsigned long rngdraws;    /* random numbers drawn since srand() */
+#ifdef PARALLEL
+static int nthreads = 1;          /* 1 runs the partitions serially */
+static unsigned int rngstate[2];  /* random number streams of A and B */
+#endif
+#ifdef CHECKPOINT
+void askcheckpoint(void);
+#endif
+#ifdef STEADYSTATE
+void asksteadystate(void);
+void recorddelivery(double);
+#endif
+#ifdef FEC
+void fecinit(void);
+void fecsend(const struct pkt *);
+void fecdeadline(int);
+int fecreceive(struct event *);
+void reportfec(void);
+#endif
+#ifdef SCENARIO
+#define DROP    0          /* what a scenario episode does to packets */
+#define CORRUPT 1
+void askscenario(void);
+int episodehit(int, int);
+void episode(int);
+void episodedelivered(int);
+void reportscenario(void);
+#endif
+#ifdef MULTIPATH
+void askmultipath(void);
+int pickpath(int, int *);
+int pathlost(int, int);
+float patharrival(int, int);
+void resequence(struct event *);
+void reseqdeadline(void);
+void recordlatency(float);
+void reportmultipath(void);
+void frommedium(struct event *);
+#endif
+#ifdef REGRESS
+void askregress(void);
+void misdelivered(void);
+#if PAYLOADSIZE < 4
+#error "the regression suite numbers messages in their first 4 bytes"
+#endif
+#endif
+#ifdef TUNE
+#ifdef REGRESS
+#error "the tuner and the regression suite both run the protocol in child processes"
+#endif
+void asktune(void);
+void runtune(void);
+void reporttune(void);
+#endif
+
+/* messages accepted by A and not yet delivered at B, oldest first.  Only
+   kept by builds that measure delivery latency or order (msglog_on) */
+struct msgrecord {
+  int id;            /* message number, nsim when it was generated */
+  float sent;        /* time it was handed to A */
+};
+static struct msgrecord *msglog;
+static int msglog_size, msglog_head, msglog_count;
+static int msglog_on;
+
+/* state of the arrival process */
+static float meanon, meanoff;     /* mean on/off period lengths for ONOFF */
+static double onoff_end;          /* time the current on period ends */
+static const char *trace_start;   /* mmap'd arrival trace, see trace_open() */
+static const char *trace_next;    /* next unread byte of the trace */
+static const char *trace_end;
+static const char *trace_dropped; /* trace pages before this were released */
+static double saturatedtime;      /* time the SATURATED source ran dry */
+static int saturateddelivered;    /* messages delivered by then */
+static double saturatedbusy;      /* time the medium to B was busy by then */
+
+/* with -DFLOWCONTROL, B's application reads a message every readtime on
+   average (uniform on [0,2*readtime]), from a buffer of rcvbufsize */
+#ifdef FLOWCONTROL
+static float readtime;
+static int rcvbufsize;
+static int unread;                /* messages delivered to B and not read yet */
+#endif
 
 /****************************************************************************/
 /* jimsrand(): return a double in range [0,1].  The routine below is used to */
@@ -94,7 +244,14 @@ double jimsrand(void)
 {
   double mmm = RAND_MAX;     /* largest int  - MACHINE DEPENDENT!!!!!!!!   */
   double x;                   
+#ifdef PARALLEL
+  /* A and B draw from separate streams so that the numbers each one gets
+     do not depend on how their events interleave */
+  x = rand_r(&rngstate[curentity])/mmm;
+#else
   x = rand()/mmm;            /* x should be uniform in [0,1] */
+  rngdraws++;                /* rand() state is only restorable by replay */
+#endif
   if (TRACE > 3)
     printf("RANDOM NUMBER GENERAION CALLED: %f\n", x);
   return(x);
@@ -104,12 +261,23 @@ double jimsrand(void)
 /*  The next set of routines handle the event list   */
 /*****************************************************/
 
+/* true if event p runs after event q.  Events at the same time run most
+   recently scheduled first, and then in entity order */
+static int later(const struct event *p, const struct event *q)
+{
+  if (p->evtime != q->evtime)
+    return p->evtime > q->evtime;
+  if (p->evcreated != q->evcreated)
+    return p->evcreated < q->evcreated;
+  return p->evcreator > q->evcreator;
+}
+
 void insertevent(struct event *p)
 {
   struct event *q,*qold;
 
   if (TRACE>2) {
-    printf("            INSERTEVENT: time is %f\n",time);
+    printf("            INSERTEVENT: time is %f\n",simtime);
     printf("            INSERTEVENT: future time will be %f\n",p->evtime); 
   }
   q = evlist;     /* q points to front of list in which p struct inserted */
@@ -119,7 +287,7 @@ void insertevent(struct event *p)
     p->prev=NULL;
   }
   else {
-    for (qold = q; q !=NULL && p->evtime > q->evtime; q=q->next)
+    for (qold = q; q !=NULL && later(p, q); q=q->next)
       qold=q; 
     if (q==NULL) {   /* end of list */
       qold->next = p;
@@ -141,6 +309,116 @@ void insertevent(struct event *p)
   }
 }
 
+/* take the next event off the event list, NULL if there is none */
+struct event *nextevent(void)
+{
+  struct event *eventptr;
+
+  eventptr = evlist;
+  if (eventptr != NULL) {
+    evlist = evlist->next;        /* remove this event from event list */
+    if (evlist!=NULL)
+      evlist->prev=NULL;
+  }
+  return eventptr;
+}
+
+#ifdef PARALLEL
+static void sendpartition(struct event *p);
+#endif
+
+/* schedule a new event created by the entity whose event is being run */
+void schedule(struct event *p)
+{
+  p->evcreated = simtime;
+  p->evcreator = curentity;
+#ifdef PARALLEL
+  if (nthreads > 1 && p->eventity != curentity) {
+    sendpartition(p);
+    return;
+  }
+#endif
+  insertevent(p);
+}
+
+/********************* ARRIVAL PROCESSES ***********************/
+
+/* exponentially distributed random variable with the given mean */
+double exponential(double mean)
+{
+  double u;
+
+  do
+    u = jimsrand();
+  while (u <= 0.0);
+  return -mean*log(u);
+}
+
+/* map an arrival trace into memory.  The trace is a text file of arrival
+   times, one per line, in increasing order; anything after the time on a
+   line and lines starting with '#' are ignored.  The file is mapped rather
+   than read so that traces larger than memory can be replayed: pages are
+   brought in as the replay reaches them and released behind it. */
+void trace_open(const char *name)
+{
+  struct stat st;
+  void *p;
+  int fd;
+
+  fd = open(name, O_RDONLY);
+  if (fd < 0 || fstat(fd, &st) < 0) {
+    printf("unable to open arrival trace %s\n", name);
+    exit(EXIT_FAILURE);
+  }
+  if (st.st_size == 0) {
+    trace_start = trace_next = trace_end = trace_dropped = NULL;
+    close(fd);
+    return;
+  }
+  p = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (p == MAP_FAILED) {
+    printf("unable to map arrival trace %s\n", name);
+    exit(EXIT_FAILURE);
+  }
+  madvise(p, st.st_size, MADV_SEQUENTIAL);
+  trace_start = trace_next = trace_dropped = p;
+  trace_end = trace_start + st.st_size;
+}
+
+/* read the next arrival time from the trace into *t.  Returns 0 at the end
+   of the trace */
+int trace_read(double *t)
+{
+  char line[64];
+  const char *eol;
+  size_t len;
+  long pagesize;
+
+  while (trace_next < trace_end) {
+    for (eol = trace_next; eol < trace_end && *eol != '\n'; eol++)
+      ;
+    len = eol - trace_next;
+    if (len >= sizeof(line))
+      len = sizeof(line) - 1;
+    memcpy(line, trace_next, len);   /* the mapping is not NUL terminated */
+    line[len] = '\0';
+    trace_next = eol < trace_end ? eol + 1 : eol;
+
+    /* give back pages that have been replayed, a few megabytes at a time */
+    pagesize = sysconf(_SC_PAGESIZE);
+    if (trace_next - trace_dropped >= 1024*pagesize) {
+      len = ((trace_next - trace_dropped) / pagesize) * pagesize;
+      madvise((void *)trace_dropped, len, MADV_DONTNEED);
+      trace_dropped += len;
+    }
+
+    if (line[0] != '#' && sscanf(line, "%lf", t) == 1)
+      return 1;
+  }
+  return 0;
+}
+
 void generate_next_arrival(void)
 {
   double x;
@@ -149,22 +427,61 @@ void generate_next_arrival(void)
   if (TRACE>2)
     printf("          GENERATE NEXT ARRIVAL: creating new arrival\n");
  
-  x = lambda*jimsrand()*2;  /* x is uniform on [0,2*lambda] */
-  /* having mean of lambda        */
+  switch (ARRIVALS) {
+  case POISSON_ARRIVALS:
+    x = exponential(lambda);   /* memoryless, mean lambda */
+    break;
+  case ONOFF_ARRIVALS:
+    /* Poisson arrivals while on.  If the next one falls after the end of
+       the burst, sit out an idle period and start a new burst */
+    x = simtime + exponential(lambda);
+    while (x > onoff_end) {
+      x = onoff_end + exponential(meanoff);
+      onoff_end = x + exponential(meanon);
+      x += exponential(lambda);
+    }
+    x -= simtime;
+    break;
+  case SATURATED_ARRIVALS:
+    x = 0.0;                  /* one event starts the source, see saturate() */
+    break;
+  case TRACE_ARRIVALS:
+    if (!trace_read(&x)) {
+      if (TRACE>2)
+        printf("          GENERATE NEXT ARRIVAL: end of arrival trace\n");
+      return;
+    }
+    x = x > simtime ? x - simtime : 0.0;
+    break;
+  default:
+    x = lambda*jimsrand()*2;  /* x is uniform on [0,2*lambda] */
+    /* having mean of lambda        */
+    break;
+  }
   evptr = malloc(sizeof(struct event));
   if (evptr == 0) {
     printf("memory allocation for event failed.");
     exit(EXIT_FAILURE);
   }
-  evptr->evtime =  time + x;
+  evptr->evtime =  simtime + x;
   evptr->evtype =  FROM_LAYER5;
   if (BIDIRECTIONAL && (jimsrand()>0.5) )
     evptr->eventity = B;
   else
     evptr->eventity = A;
-  insertevent(evptr);
+  schedule(evptr);
 } 
 
+/* start the arrival process from the beginning: the trace from its first
+   line, the on/off source in a new burst, and the first arrival */
+static void startarrivals(void)
+{
+  trace_next = trace_dropped = trace_start;
+  if (ARRIVALS == ONOFF_ARRIVALS)
+    onoff_end = exponential(meanon);   /* start in a burst */
+  generate_next_arrival();
+}
+
 void printevlist(void)
 {
   struct event *q;
@@ -179,6 +496,7 @@ void init(void)                         /* initialize the simulator */
 {
   float sum, avg;
   int i;
+  char tracename[256];
 
   printf("-----  Stop and Wait Network Simulator Version 1.1 -------- \n\n");
   printf("Enter the number of messages to simulate: ");
@@ -193,11 +511,69 @@ void init(void)                         /* initialize the simulator */
   }
   printf("Enter average time between messages from sender's layer5 [ > 0.0]:");
   scanf("%f",&lambda);
+  if (ARRIVALS == ONOFF_ARRIVALS) {
+    printf("Enter average length of an on (burst) period:");
+    scanf("%f",&meanon);
+    printf("Enter average length of an off (idle) period:");
+    scanf("%f",&meanoff);
+  }
+  if (ARRIVALS == TRACE_ARRIVALS) {
+    printf("Enter the name of the arrival trace file:");
+    scanf("%255s",tracename);
+    trace_open(tracename);
+  }
   printf("Enter TRACE:");
   scanf("%d",&TRACE);
+#ifdef SETWINDOW
+  printf("Enter the sender window size:");
+  scanf("%d",&windowsize);
+#endif
+#ifdef FLOWCONTROL
+  printf("Enter the average time B's application takes to read a message:");
+  scanf("%f",&readtime);
+  printf("Enter the size of B's receive buffer in messages [ > 0]:");
+  scanf("%d",&rcvbufsize);
+  if (rcvbufsize < 1) {
+    printf("the receive buffer must hold at least one message\n");
+    exit(EXIT_FAILURE);
+  }
+  unread = 0;
+#endif
 
 
+#ifdef PARALLEL
+  printf("Enter the number of threads [1 runs A and B serially, 2 in parallel]:");
+  scanf("%d",&nthreads);
+  rngstate[A] = 9999;       /* init random number generators */
+  rngstate[B] = 19999;
+  if (ARRIVALS == SATURATED_ARRIVALS && nthreads > 1) {
+    printf("the saturated source reads B's statistics, so it runs A and B serially\n");
+    exit(EXIT_FAILURE);
+  }
+#endif
+#ifdef CHECKPOINT
+  askcheckpoint();
+#endif
+#ifdef STEADYSTATE
+  asksteadystate();
+#endif
+#ifdef REGRESS
+  askregress();
+#endif
+#ifdef TUNE
+  asktune();
+#endif
+#ifdef FEC
+  fecinit();
+#endif
+#ifdef SCENARIO
+  askscenario();
+#endif
+#ifdef MULTIPATH
+  askmultipath();
+#endif
   srand(9999);              /* init random number generator */
+  rngdraws = 0;
   sum = 0.0;                /* test random number generator for students */
   for (i=0; i<1000; i++)
     sum+=jimsrand();    /* jimsrand() should be uniform in [0,1] */
@@ -213,6 +589,8 @@ void init(void)                         /* initialize the simulator */
   window_full = 0;
   total_ACKs_received = 0;
   packets_resent = 0;
+  fast_retransmits = 0;
+  window_probes = 0;
   new_ACKs = 0;
   packets_received = 0;
   packets_lost = 0;  
@@ -221,12 +599,16 @@ void init(void)                         /* initialize the simulator */
   packets_timeout = 0;
   messages_delivered = 0;
 
-  ntolayer3 = 0;
-  nlost = 0;
-  ncorrupt = 0;
+  for (i=A; i<=B; i++) {
+    ntolayer3[i] = 0;
+    nlost[i] = 0;
+    ncorrupt[i] = 0;
+    lastarrival[i] = 0.0;
+    linkbusy[i] = 0.0;
+  }
 
-  time=0.0;                    /* initialize time to 0.0 */
-  generate_next_arrival();     /* initialize event list */
+  simtime=0.0;                 /* initialize time to 0.0 */
+  startarrivals();             /* initialize event list */
 }
 
 /********************** Student-callable ROUTINES ***********************/
@@ -238,7 +620,7 @@ void stoptimer(int AorB)
   struct event *q;
 
   if (TRACE>1)
-    printf("          STOP TIMER: stopping timer at %f\n",time);
+    printf("          STOP TIMER: stopping timer at %f\n",simtime);
   /* for (q=evlist; q!=NULL && q->next!=NULL; q = q->next)  */
   for (q=evlist; q!=NULL ; q = q->next) 
     if ( (q->evtype==TIMER_INTERRUPT  && q->eventity==AorB) ) { 
@@ -270,7 +652,7 @@ void starttimer(int AorB, double increment)
   struct event *evptr;
 
   if (TRACE>1)
-    printf("          START TIMER: starting timer at %f\n",time);
+    printf("          START TIMER: starting timer at %f\n",simtime);
   /* be nice: check to see if timer is already started, if so, then  warn */
   /* for (q=evlist; q!=NULL && q->next!=NULL; q = q->next)  */
   for (q=evlist; q!=NULL ; q = q->next)  
@@ -285,50 +667,82 @@ void starttimer(int AorB, double increment)
     printf("memory allocation for event failed.");
     exit(EXIT_FAILURE);
   }
-  evptr->evtime =  time + increment;
+  evptr->evtime =  simtime + increment;
   evptr->evtype =  TIMER_INTERRUPT;
    
  
   evptr->eventity = AorB;
-  insertevent(evptr);
+  schedule(evptr);
 } 
 
 
 /************************** TOLAYER3 ***************/
 void tolayer3(int AorB, struct pkt packet)
 /* A or B is sending to network  */
+{
+  struct pkt *p;
+
+  /* copy the caller's packet once into a buffer and send that */
+  p = pkt_alloc();
+  *p = packet;
+  tolayer3_ref(AorB, p);
+  pkt_release(p);
+}
+
+void transmit(int, const struct pkt *, int, int);
+
+void tolayer3_ref(int AorB, const struct pkt *packet)
+/* A or B is sending to network, without copying the packet  */
+{
+#ifdef FEC
+  if (AorB == A) {
+    fecsend(packet);          /* adds the parity packets */
+    return;
+  }
+#endif
+  transmit(AorB, packet, 0, 0);
+}
+
+/* put a packet into the medium, with its FEC header if any */
+void transmit(int AorB, const struct pkt *packet, int fecgroup, int fecslot)
 {
   struct pkt *mypktptr;
-  struct event *evptr,*q;
-  float lastime, x;
+  struct event *evptr;
+  float x;
   int i;
+#ifdef MULTIPATH
+  int path, pathseq;
+#else
+  float lastime;
+#endif
 
-  ntolayer3++;
+  ntolayer3[AorB]++;
+#ifdef MULTIPATH
+  path = pickpath(AorB, &pathseq);
+#endif
 
   /* simulate losses: */
-  if (jimsrand() < lossprob && (!(AorB == B && corruptdirection == A) && !(AorB == A && corruptdirection == B))) {
-    nlost++;
+  if ((jimsrand() < lossprob && (!(AorB == B && corruptdirection == A) && !(AorB == A && corruptdirection == B)))
+#ifdef SCENARIO
+      || episodehit(AorB, DROP)
+#endif
+#ifdef MULTIPATH
+      || pathlost(path, AorB)
+#endif
+      ) {
+    nlost[AorB]++;
     if (TRACE>0)    
       printf("          TOLAYER3: packet being lost\n");
     return;
   }  
 
-  /* make a copy of the packet student just gave me since he/she may decide */
-  /* to do something with the packet after we return back to him/her */ 
-  mypktptr = malloc(sizeof(struct pkt));
-  if (mypktptr == 0) {
-    printf("memory allocation for event failed.");
-    exit(EXIT_FAILURE);
-  }
-  mypktptr->seqnum = packet.seqnum;
-  mypktptr->acknum = packet.acknum;
-  mypktptr->checksum = packet.checksum;
-  for (i=0; i<20; i++)
-    mypktptr->payload[i] = packet.payload[i];
+  /* keep a reference to the packet rather than a copy.  Callers must not */
+  /* change a packet once they have sent it; corruption below copies it   */
+  mypktptr = (struct pkt *)pkt_hold(packet);
   if (TRACE>2)  {
     printf("          TOLAYER3: seq: %d, ack %d, check: %d ", mypktptr->seqnum,
            mypktptr->acknum,  mypktptr->checksum);
-    for (i=0; i<20; i++)
+    for (i=0; i<PAYLOADSIZE; i++)
       printf("%c",mypktptr->payload[i]);
     printf("\n");
   }
@@ -342,22 +756,44 @@ void tolayer3(int AorB, struct pkt packet)
   evptr->evtype =  FROM_LAYER3;   /* packet will pop out from layer3 */
   evptr->eventity = (AorB+1) % 2; /* event occurs at other entity */
   evptr->pktptr = mypktptr;       /* save ptr to my copy of packet */
+#ifdef FEC
+  evptr->fecgroup = fecgroup;
+  evptr->fecslot = fecslot;
+#else
+  (void)fecgroup;                 /* no FEC header without FEC */
+  (void)fecslot;
+#endif
+#ifdef MULTIPATH
+  evptr->path = path;
+  evptr->pathseq = pathseq;
+  evptr->evtime = patharrival(path, evptr->eventity);
+#else
   /* finally, compute the arrival time of packet at the other end.
      medium can not reorder, so make sure packet arrives between 1 and 10
      time units after the latest arrival time of packets
      currently in the medium on their way to the destination */
-  lastime = time;
-  /* for (q=evlist; q!=NULL && q->next!=NULL; q = q->next) */
-  for (q=evlist; q!=NULL ; q = q->next) 
-    if ( (q->evtype==FROM_LAYER3  && q->eventity==evptr->eventity) ) 
-      lastime = q->evtime;
+  lastime = simtime;
+  if (lastarrival[evptr->eventity] > lastime)
+    lastime = lastarrival[evptr->eventity];
   evptr->evtime =  lastime + 1 + 9*jimsrand();
+  lastarrival[evptr->eventity] = evptr->evtime;
+  linkbusy[evptr->eventity] += evptr->evtime - lastime;
+#endif
  
 
 
   /* simulate corruption: */
-  if ((jimsrand() < corruptprob)  && (!(AorB == B && corruptdirection == A) && !(AorB == A && corruptdirection == B))) {
-    ncorrupt++;
+  if (((jimsrand() < corruptprob)  && (!(AorB == B && corruptdirection == A) && !(AorB == A && corruptdirection == B)))
+#ifdef SCENARIO
+      || episodehit(AorB, CORRUPT)
+#endif
+      ) {
+    ncorrupt[AorB]++;
+    /* the packet may be shared with the sender's window, so corrupt a copy */
+    mypktptr = pkt_alloc();
+    *mypktptr = *evptr->pktptr;
+    pkt_release(evptr->pktptr);
+    evptr->pktptr = mypktptr;
     if ( (x = jimsrand()) < .75)
       mypktptr->payload[0]='Z';   /* corrupt payload */
     else if (x < .875)
@@ -370,109 +806,2189 @@ void tolayer3(int AorB, struct pkt packet)
 
   if (TRACE>2)  
     printf("          TOLAYER3: scheduling arrival on other side\n");
-  insertevent(evptr);
+  schedule(evptr);
 } 
 
-void tolayer5(int AorB, char datasent[20])
+#ifdef FEC
+/********************* FORWARD ERROR CORRECTION ***********************/
+/* Packets from A are sent in groups of k, each followed by a parity
+   packet, the XOR of the k packets.  If B gets the parity and all but one
+   of the group, the XOR of those is the missing packet, which is handed
+   to B as if it had arrived.  The medium keeps packets in order, so B
+   only tracks the current group.  Groups whose parity arrives give B the
+   number of data packets lost, and k follows an average of that loss
+   rate: a group of k+1 packets should lose about half a packet, so
+   k = 0.5/loss - 1, within [FECMINK, FECMAXK].  A corrupted packet counts
+   as received, and a packet rebuilt with it fails the protocol's
+   checksum like any corrupted packet.  B holds back the packets after a
+   gap until the parity comes, so the medium still does not reorder
+   packets.  To bound that wait, a group is closed with fewer than k
+   packets FECDELAY time units after its first was sent, or as soon after
+   as it has FECMINK. */
+
+#define FECMINK   2
+#define FECMAXK   16
+#define FECALPHA  0.125         /* weight of the newest group in the loss estimate */
+#ifndef FECDELAY
+#define FECDELAY  4.0           /* deadline of a group, a quarter of the RTT */
+#endif
+
+static struct {
+  int k;                        /* size of A's current group */
+  int group, count;             /* A's current group, data packets sent in it */
+  int overdue;                  /* its deadline has passed */
+  struct pkt parity;            /* XOR of those */
+  int rxgroup, rxcount;         /* B's current group, data packets received */
+  struct pkt rxparity;          /* XOR of those */
+  int rxnext;                   /* slots passed on to B in order so far */
+  const struct pkt *held[FECMAXK];  /* packets after a gap, by slot */
+  double loss;                  /* estimated loss rate of data packets */
+  int nparity;                  /* parity packets sent */
+  int nrecovered;               /* packets rebuilt at B */
+} fec;
+
+void fecinit(void)
 {
-  int i;  
-  if (TRACE>2) {
-    printf("          TOLAYER5: data received by application at ");
-    if (AorB == A) 
-      printf("A: ");
+#ifdef PARALLEL
+  if (nthreads > 1) {
+    printf("FEC shares its loss estimate between A and B, so it runs them serially\n");
+    exit(EXIT_FAILURE);
+  }
+#endif
+  memset(&fec, 0, sizeof(fec));
+  fec.loss = 0.1;
+  fec.k = 4;                    /* 0.5/0.1 - 1 */
+  fec.rxgroup = -1;
+}
+
+static void fecxor(struct pkt *acc, const struct pkt *p)
+{
+  unsigned char *a = (unsigned char *)acc;
+  const unsigned char *b = (const unsigned char *)p;
+  size_t i;
+
+  for (i=0; i<sizeof(struct pkt); i++)
+    a[i] ^= b[i];
+}
+
+/* send the parity of A's current group and start the next */
+static void fecclose(void)
+{
+  struct pkt *parity;
+  int k;
+
+  parity = pkt_alloc();
+  *parity = fec.parity;
+  if (TRACE>2)
+    printf("          FEC: parity of group %d, %d packets\n", fec.group, fec.count);
+  transmit(A, parity, fec.group, -fec.count);
+  pkt_release(parity);
+  fec.nparity++;
+
+  fec.group++;
+  fec.count = 0;
+  fec.overdue = 0;
+  memset(&fec.parity, 0, sizeof(fec.parity));
+  k = fec.loss > 0.0 ? (int)(0.5/fec.loss) - 1 : FECMAXK;
+  fec.k = k < FECMINK ? FECMINK : k > FECMAXK ? FECMAXK : k;
+}
+
+void fecsend(const struct pkt *packet)
+{
+  struct event *evptr;
+
+  if (fec.count == 0) {         /* a new group must close by its deadline */
+    evptr = malloc(sizeof(struct event));
+    if (evptr == 0) {
+      printf("memory allocation for event failed.");
+      exit(EXIT_FAILURE);
+    }
+    evptr->evtime = simtime + FECDELAY;
+    evptr->evtype = FEC_DEADLINE;
+    evptr->eventity = A;
+    evptr->pktptr = NULL;
+    evptr->fecgroup = fec.group;
+    evptr->fecslot = 0;
+    schedule(evptr);
+  }
+  fecxor(&fec.parity, packet);
+  transmit(A, packet, fec.group, fec.count++);
+  if (fec.count == fec.k || (fec.overdue && fec.count >= FECMINK))
+    fecclose();
+}
+
+/* the deadline of a group has come.  Close it if it is still open, but
+   not with a single packet: that parity would just be a copy */
+void fecdeadline(int group)
+{
+  if (group != fec.group)
+    return;
+  if (fec.count >= FECMINK)
+    fecclose();
+  else
+    fec.overdue = 1;            /* close it as soon as it may */
+}
+
+/* hand B the packets held for the current group, in order */
+static void fecflush(void)
+{
+  int i;
+
+  for (i=0; i<FECMAXK; i++)
+    if (fec.held[i] != NULL) {
+      B_input_ref(fec.held[i]);
+      pkt_release(fec.held[i]);
+      fec.held[i] = NULL;
+    }
+}
+
+/* a packet arrived at B.  Returns 1 if B is not to see it yet: it is
+   a parity packet, or data held behind a gap */
+int fecreceive(struct event *ev)
+{
+  struct pkt *rebuilt;
+  int k, lost, slot;
+
+  if (ev->fecgroup != fec.rxgroup) {      /* the last group's parity was lost */
+    fecflush();
+    fec.rxgroup = ev->fecgroup;
+    fec.rxcount = fec.rxnext = 0;
+    memset(&fec.rxparity, 0, sizeof(fec.rxparity));
+  }
+  if (ev->fecslot >= 0) {                 /* data */
+    fecxor(&fec.rxparity, ev->pktptr);
+    fec.rxcount++;
+    if (ev->fecslot == fec.rxnext) {      /* nothing missing yet */
+      fec.rxnext++;
+      return 0;
+    }
+    fec.held[ev->fecslot] = pkt_hold(ev->pktptr);
+    return 1;
+  }
+
+  k = -ev->fecslot;
+  lost = k - fec.rxcount;
+  fec.loss = (1.0 - FECALPHA)*fec.loss + FECALPHA*lost/k;
+  if (lost == 1) {
+    /* the missing packet is the only gap after the ones passed on */
+    for (slot=fec.rxnext; fec.held[slot] != NULL; slot++)
+      ;
+    rebuilt = pkt_alloc();
+    *rebuilt = fec.rxparity;
+    fecxor(rebuilt, ev->pktptr);
+    fec.held[slot] = rebuilt;
+    fec.nrecovered++;
+    if (TRACE>2)
+      printf("          FEC: rebuilt packet %d of group %d\n", rebuilt->seqnum, fec.rxgroup);
+  }
+  fecflush();
+  fec.rxgroup = -1;                       /* the group is over */
+  return 1;
+}
+
+void reportfec(void)
+{
+  printf("FEC: %d parity packets sent, %d packets rebuilt at B (%d resent by A), group size now %d\n",
+         fec.nparity, fec.nrecovered, packets_resent + fast_retransmits, fec.k);
+}
+#endif
+
+#ifdef SCENARIO
+/********************* SCENARIOS ***********************/
+/* A scenario file lists episodes of extra loss or corruption, one a line:
+       <start> <end> <A->B|B->A|both> <drop|corrupt> <probability>
+   so "1000 1200 A->B drop 1" drops everything A sends from time 1000 to
+   1200, and "500 800 B->A corrupt 0.5" corrupts half of B's packets for
+   300 time units.  Lines starting with # are comments.  Each episode
+   starts and ends with an event, and while it is on, each packet sent in
+   its direction is dropped or corrupted with its probability, on top of
+   the run's own loss and corruption.  Episodes may overlap.
+   When an episode ends, the messages accepted by A and not yet delivered
+   are its backlog, and its time to recover is the time from its end until
+   the last of them is delivered. */
+
+#define MAXEPISODES 64
+
+struct episode {
+  float start, end;
+  int direction;                /* A, B (for B->A) or 2 for both */
+  int kind;                     /* DROP or CORRUPT */
+  float prob;
+  int on;
+  int hit;                      /* packets it dropped or corrupted */
+  int refused;                  /* messages refused for a full window while on */
+  int backlog;                  /* undelivered messages when it ended */
+  int lastid;                   /* the last of those */
+  float recovered;              /* time that was delivered, -1 until then */
+};
+
+static struct {
+  int n;
+  int pending;                  /* ended episodes whose backlog is not delivered */
+  struct episode ep[MAXEPISODES];
+} scenario;
+
+static void scheduleepisode(int i, float t)
+{
+  struct event *evptr;
+
+  evptr = malloc(sizeof(struct event));
+  if (evptr == 0) {
+    printf("memory allocation for event failed.");
+    exit(EXIT_FAILURE);
+  }
+  evptr->evtime = t;
+  evptr->evtype = EPISODE;
+  evptr->eventity = A;
+  evptr->pktptr = NULL;
+  evptr->episode = i;
+  schedule(evptr);
+}
+
+void askscenario(void)
+{
+  char name[256], line[256], dir[16], kind[16];
+  struct episode *e;
+  FILE *f;
+  int lineno;
+
+  printf("Enter the name of the scenario file:");
+  scanf("%255s",name);
+#ifdef PARALLEL
+  if (nthreads > 1) {
+    printf("scenarios need A and B to run serially\n");
+    exit(EXIT_FAILURE);
+  }
+#endif
+  if ((f = fopen(name, "r")) == NULL) {
+    printf("unable to open scenario file %s\n", name);
+    exit(EXIT_FAILURE);
+  }
+  memset(&scenario, 0, sizeof(scenario));
+  for (lineno=1; fgets(line, sizeof(line), f) != NULL; lineno++) {
+    if (line[strspn(line, " \t\r\n")] == '\0' || line[strspn(line, " \t")] == '#')
+      continue;
+    if (scenario.n == MAXEPISODES) {
+      printf("%s: more than %d episodes\n", name, MAXEPISODES);
+      exit(EXIT_FAILURE);
+    }
+    e = &scenario.ep[scenario.n];
+    if (sscanf(line, "%f %f %15s %15s %f", &e->start, &e->end, dir, kind, &e->prob) != 5
+        || e->start < 0.0 || e->end <= e->start || e->prob < 0.0 || e->prob > 1.0) {
+      printf("%s:%d: expected <start> <end> <A->B|B->A|both> <drop|corrupt> <probability>\n", name, lineno);
+      exit(EXIT_FAILURE);
+    }
+    if (strcmp(dir, "A->B") == 0)
+      e->direction = A;
+    else if (strcmp(dir, "B->A") == 0)
+      e->direction = B;
+    else if (strcmp(dir, "both") == 0)
+      e->direction = 2;
+    else {
+      printf("%s:%d: unknown direction %s\n", name, lineno, dir);
+      exit(EXIT_FAILURE);
+    }
+    if (strcmp(kind, "drop") == 0)
+      e->kind = DROP;
+    else if (strcmp(kind, "corrupt") == 0)
+      e->kind = CORRUPT;
+    else {
+      printf("%s:%d: unknown action %s\n", name, lineno, kind);
+      exit(EXIT_FAILURE);
+    }
+    e->recovered = -1.0;
+    scheduleepisode(scenario.n, e->start);
+    scheduleepisode(scenario.n, e->end);
+    scenario.n++;
+  }
+  fclose(f);
+  msglog_on = 1;
+}
+
+/* true if an episode that is on drops (or corrupts) the packet AorB is sending */
+int episodehit(int AorB, int kind)
+{
+  struct episode *e;
+  int i;
+
+  for (i=0; i<scenario.n; i++) {
+    e = &scenario.ep[i];
+    if (e->on && e->kind == kind && (e->direction == AorB || e->direction == 2)
+        && jimsrand() < e->prob) {
+      e->hit++;
+      return 1;
+    }
+  }
+  return 0;
+}
+
+/* episode i starts or ends */
+void episode(int i)
+{
+  struct episode *e = &scenario.ep[i];
+
+  e->on = !e->on;
+  if (e->on) {
+    e->refused = window_full;
+    if (TRACE>0)
+      printf("          SCENARIO: episode %d starts\n", i);
+    return;
+  }
+  e->refused = window_full - e->refused;
+  e->backlog = msglog_count;
+  if (msglog_count == 0)
+    e->recovered = simtime;
+  else {
+    e->lastid = msglog[(msglog_head + msglog_count - 1) % msglog_size].id;
+    scenario.pending++;
+  }
+  if (TRACE>0)
+    printf("          SCENARIO: episode %d ends, %d messages outstanding\n", i, e->backlog);
+}
+
+/* message id was delivered at B */
+void episodedelivered(int id)
+{
+  struct episode *e;
+  int i;
+
+  if (scenario.pending == 0)
+    return;
+  for (i=0; i<scenario.n; i++) {
+    e = &scenario.ep[i];
+    if (!e->on && e->backlog > 0 && e->recovered < 0.0 && id >= e->lastid) {
+      e->recovered = simtime;
+      scenario.pending--;
+    }
+  }
+}
+
+void reportscenario(void)
+{
+  static const char *dirname[] = { "A->B", "B->A", "both" };
+  struct episode *e;
+  int i;
+
+  for (i=0; i<scenario.n; i++) {
+    e = &scenario.ep[i];
+    printf("episode %d: %s %s %.2f from %.1f to %.1f: %d packets hit, %d messages refused, ",
+           i, dirname[e->direction], e->kind == DROP ? "drop" : "corrupt", e->prob,
+           e->start, e->end, e->hit, e->refused);
+    if (e->start > simtime)
+      printf("after the end of the run\n");
+    else if (e->on)
+      printf("still on at the end of the run\n");
+    else if (e->recovered < 0.0)
+      printf("backlog %d, not drained by the end of the run\n", e->backlog);
     else
-      printf("B: ");
-    for (i=0; i<20; i++)  
-      printf("%c",datasent[i]);
-    printf("\n");
+      printf("backlog %d drained in %.1f\n", e->backlog, e->recovered - e->end);
   }
-  messages_delivered++;
 }
+#endif
 
-int main(void)
+#ifdef MULTIPATH
+/********************* MULTIPATH ***********************/
+/* A and B are joined by up to MAXPATHS paths in each direction instead of
+   the one medium.  Each path has a least delay, a random extra delay of
+   up to its spread, a loss probability (on top of the run's own) and a
+   capacity in packets per time unit.  A path carries one packet at a
+   time, so a packet waits for those before it to be put on, and keeps
+   them in order: none comes out sooner than 1/capacity after the one
+   before.  The sender's scheduler picks the path of each packet:
+   MINRTT the one it would arrive soonest on, queue included, and WRR
+   each path in turn in proportion to its capacity (smooth weighted
+   round-robin).
+   Packets to B are numbered in the order they are sent, and the
+   resequencer at B passes them on in that order.  It gives up on a
+   missing packet once every path has brought one sent after it, as it
+   was lost, or once a packet behind it has waited as long as any path
+   can take without a queue.  A packet that comes after all is passed on
+   late.  ACKs to A are not resequenced, both protocols take them in any
+   order.  Latencies of delivered messages are kept for their tail. */
+
+#define MAXPATHS  8
+#define MINRTT    0
+#define WRR       1
+#define RESEQSIZE 256           /* packets B can hold out of order */
+
+static struct {
+  float delay, spread, loss;
+  float txtime;                 /* 1/capacity */
+  float free[2];                /* time the path to A, B can take a packet */
+  float lastarrival[2];
+  double credit[2];             /* for WRR */
+  double busy[2];               /* time it spent putting packets on */
+  int sent[2], lost[2];
+} paths[MAXPATHS];
+
+static int npaths;
+static int scheduler;
+static int txseq[2];            /* number of the next packet sent to A, B */
+static float reseqhold;         /* the longest a path takes without a queue */
+
+static struct {
+  int next;                     /* the next packet to pass to B */
+  int lastseq[MAXPATHS];        /* latest packet from each path, -1 if none */
+  struct event held[RESEQSIZE]; /* packets after a gap, at number % RESEQSIZE */
+  int nheld;
+  int deadline;                 /* a RESEQ_DEADLINE event is pending */
+  int nreordered;               /* packets held */
+  int nskipped;                 /* gaps given up on */
+  int nlate;                    /* packets that came after their gap was */
+} reseq;
+
+static float *latencies;        /* of the messages delivered */
+static int nlatencies, maxlatencies;
+
+void askmultipath(void)
 {
-  struct event *eventptr;
-  struct msg  msg2give;
-  struct pkt  pkt2give;
-   
-  int i,j;
-  
-  init();
-  A_init();
-  B_init();
-   
-  while (1) {
-    eventptr = evlist;            /* get next event to simulate */
-    if (eventptr==NULL)
-      goto terminate;
-    evlist = evlist->next;        /* remove this event from event list */
-    if (evlist!=NULL)
-      evlist->prev=NULL;
-    if (TRACE>=2) {
-      printf("\nEVENT time: %f,",eventptr->evtime);
-      printf("  type: %d",eventptr->evtype);
-      if (eventptr->evtype==0)
-        printf(", timerinterrupt  ");
-      else if (eventptr->evtype==1)
-        printf(", fromlayer5 ");
-      else
-        printf(", fromlayer3 ");
-      printf(" entity: %d\n",eventptr->eventity);
-    }
-    time = eventptr->evtime;        /* update time to next event time */
-    if (eventptr->evtype == FROM_LAYER5 ) {
-      if (nsim < nsimmax) {
-        generate_next_arrival();   /* set up future arrival */
-        /* fill in msg to give with string of same letter */    
-        j = nsim % 26; 
-        for (i=0; i<20; i++)  
-          msg2give.data[i] = 97 + j;
-        if (TRACE>2) {
-          printf("          MAINLOOP: data given to student: ");
-          for (i=0; i<20; i++) 
-            printf("%c", msg2give.data[i]);
-          printf("\n");
-        }
-        nsim++;
-        if (eventptr->eventity == A) 
-          A_output(msg2give);  
-        else
-          B_output(msg2give);  
+  int i;
+  float capacity;
+
+  printf("Enter the number of paths [1 to %d]:", MAXPATHS);
+  scanf("%d",&npaths);
+  if (npaths < 1 || npaths > MAXPATHS) {
+    printf("the number of paths must be from 1 to %d\n", MAXPATHS);
+    exit(EXIT_FAILURE);
+  }
+  memset(paths, 0, sizeof(paths));
+  reseqhold = 0.0;
+  for (i=0; i<npaths; i++) {
+    printf("Enter path %d's least delay [ >= 1], extra random delay, loss probability and capacity [packets per time unit]:", i);
+    scanf("%f %f %f %f", &paths[i].delay, &paths[i].spread, &paths[i].loss, &capacity);
+    /* at least the one time unit a packet spends in the single medium */
+    if (paths[i].delay < 1.0 || paths[i].spread < 0.0 || capacity <= 0.0) {
+      printf("a path needs a least delay of at least 1 and a positive capacity\n");
+      exit(EXIT_FAILURE);
+    }
+    paths[i].txtime = 1.0 / capacity;
+    if (paths[i].txtime + paths[i].delay + paths[i].spread > reseqhold)
+      reseqhold = paths[i].txtime + paths[i].delay + paths[i].spread;
+  }
+  printf("Enter the scheduler: 0 min-RTT, 1 weighted round-robin:");
+  scanf("%d",&scheduler);
+#ifdef PARALLEL
+  if (nthreads > 1) {
+    printf("the resequencer reads A's message log, so multipath runs A and B serially\n");
+    exit(EXIT_FAILURE);
+  }
+#endif
+
+  memset(&reseq, 0, sizeof(reseq));
+  for (i=0; i<MAXPATHS; i++)
+    reseq.lastseq[i] = -1;
+  txseq[A] = txseq[B] = 0;
+  nlatencies = 0;
+  msglog_on = 1;
+}
+
+/* choose the path for a packet from AorB and put it on.  Returns the path */
+int pickpath(int AorB, int *seq)
+{
+  int to = (AorB+1) % 2;
+  int i, best = 0;
+  double t, soonest = 0.0, total = 0.0;
+
+  for (i=0; i<npaths; i++) {
+    if (scheduler == WRR) {
+      paths[i].credit[to] += 1.0 / paths[i].txtime;
+      total += 1.0 / paths[i].txtime;
+      if (paths[i].credit[to] > paths[best].credit[to])
+        best = i;
+    }
+    else {
+      t = (simtime > paths[i].free[to] ? simtime : paths[i].free[to])
+          + paths[i].txtime + paths[i].delay + paths[i].spread/2;
+      if (i == 0 || t < soonest) {
+        soonest = t;
+        best = i;
       }
-      else if (TRACE > 2)
-          printf("          FROM_LAYER5: no more messages to send: \n");
-    }
-    else if (eventptr->evtype ==  FROM_LAYER3) {
-      pkt2give.seqnum = eventptr->pktptr->seqnum;
-      pkt2give.acknum = eventptr->pktptr->acknum;
-      pkt2give.checksum = eventptr->pktptr->checksum;
-      for (i=0; i<20; i++)  
-        pkt2give.payload[i] = eventptr->pktptr->payload[i];
-	    if (eventptr->eventity ==A)      /* deliver packet by calling */
-        A_input(pkt2give);            /* appropriate entity */
-      else
-        B_input(pkt2give);
-	    free(eventptr->pktptr);          /* free the memory for packet */
     }
-    else if (eventptr->evtype ==  TIMER_INTERRUPT) {
-      if (eventptr->eventity == A) 
-        A_timerinterrupt();
-      else
-        B_timerinterrupt();
+  }
+  if (scheduler == WRR)
+    paths[best].credit[to] -= total;
+
+  if (paths[best].free[to] < simtime)
+    paths[best].free[to] = simtime;
+  paths[best].free[to] += paths[best].txtime;
+  paths[best].busy[to] += paths[best].txtime;
+  linkbusy[to] += paths[best].txtime / npaths;   /* the paths' mean */
+  paths[best].sent[to]++;
+  *seq = txseq[to]++;
+  return best;
+}
+
+/* true if path p loses the packet AorB put on it */
+int pathlost(int p, int AorB)
+{
+  if (jimsrand() < paths[p].loss) {
+    paths[p].lost[(AorB+1) % 2]++;
+    return 1;
+  }
+  return 0;
+}
+
+/* time the packet just put on path p comes out at entity to */
+float patharrival(int p, int to)
+{
+  float t;
+
+  t = paths[p].free[to] + paths[p].delay + paths[p].spread*jimsrand();
+  if (t < paths[p].lastarrival[to] + paths[p].txtime)
+    t = paths[p].lastarrival[to] + paths[p].txtime;
+  paths[p].lastarrival[to] = t;
+  return t;
+}
+
+/* arrival time of the oldest packet held after the gap at reseq.next */
+static float oldestheld(void)
+{
+  int n;
+
+  for (n = reseq.next + 1; reseq.held[n % RESEQSIZE].pktptr == NULL; n++)
+    ;
+  return reseq.held[n % RESEQSIZE].evtime;
+}
+
+/* pass B the held packets from reseq.next on, over the gaps that are
+   given up, and all of them up to number upto */
+static void reseqpass(int upto)
+{
+  struct event *ev;
+  int p;
+
+  while (reseq.nheld > 0 || reseq.next <= upto) {
+    ev = &reseq.held[reseq.next % RESEQSIZE];
+    if (ev->pktptr == NULL && reseq.next > upto) {
+      for (p=0; p<npaths && reseq.lastseq[p] > reseq.next; p++)
+        ;
+      if (p < npaths && simtime < oldestheld() + reseqhold)
+        break;                  /* it may still come */
+    }
+    if (ev->pktptr == NULL) {
+      if (TRACE>2)
+        printf("          RESEQ: giving up on packet %d\n", reseq.next);
+      reseq.nskipped++;
     }
-    else  {
-      printf("INTERNAL PANIC: unknown event type \n");
+    else {
+      frommedium(ev);
+      ev->pktptr = NULL;
+      reseq.nheld--;
     }
-    free(eventptr);
+    reseq.next++;
   }
 
- terminate:
-  printf(" Simulator terminated at time %f\n after attempting to send %d msgs from layer5\n",time,nsim);
-  printf("number of messages dropped due to full window:  %d \n", window_full);
-  printf("number of valid (not corrupt or duplicate) acknowledgements received at A:  %d \n", new_ACKs);
-  printf("(note: a single acknowledgement may have acknowledged more than one packet - if cumulative acknowledgements are used)\n");
-  printf("number of packet resends by A:  %d \n", packets_resent);
-  printf("number of correct packets received at B:  %d \n", packets_received);
-  printf("number of messages delivered to application:  %d \n", messages_delivered);
-  return EXIT_SUCCESS;
-}
\ No newline at end of file
+  if (reseq.nheld > 0 && !reseq.deadline) {
+    ev = malloc(sizeof(struct event));
+    if (ev == 0) {
+      printf("memory allocation for event failed.");
+      exit(EXIT_FAILURE);
+    }
+    ev->evtime = oldestheld() + reseqhold;
+    ev->evtype = RESEQ_DEADLINE;
+    ev->eventity = B;
+    ev->pktptr = NULL;
+    schedule(ev);
+    reseq.deadline = 1;
+  }
+}
+
+/* a packet came out of a path at B */
+void resequence(struct event *ev)
+{
+  int n = ev->pathseq;
+
+  reseq.lastseq[ev->path] = n;
+  if (n < reseq.next) {         /* its gap was given up */
+    reseq.nlate++;
+    frommedium(ev);
+    return;
+  }
+  if (n != reseq.next) {
+    if (TRACE>2)
+      printf("          RESEQ: holding packet %d until %d comes\n", n, reseq.next);
+    reseq.nreordered++;
+  }
+  if (n - reseq.next >= RESEQSIZE)
+    reseqpass(n - RESEQSIZE);   /* make room */
+  reseq.held[n % RESEQSIZE] = *ev;   /* takes the event's reference */
+  reseq.nheld++;
+  reseqpass(-1);
+}
+
+/* a packet held at B has waited as long as it can */
+void reseqdeadline(void)
+{
+  reseq.deadline = 0;
+  reseqpass(-1);
+}
+
+void recordlatency(float latency)
+{
+  float *bigger;
+
+  if (nlatencies == maxlatencies) {
+    maxlatencies = maxlatencies ? 2*maxlatencies : 1024;
+    bigger = realloc(latencies, maxlatencies * sizeof(float));
+    if (bigger == 0) {
+      printf("memory allocation for latencies failed.");
+      exit(EXIT_FAILURE);
+    }
+    latencies = bigger;
+  }
+  latencies[nlatencies++] = latency;
+}
+
+static int cmpfloat(const void *a, const void *b)
+{
+  float x = *(const float *)a, y = *(const float *)b;
+
+  return (x > y) - (x < y);
+}
+
+void reportmultipath(void)
+{
+  static const char *schedname[] = { "min-RTT", "weighted round-robin" };
+  double sum = 0.0;
+  int i;
+
+  for (i=0; i<npaths; i++)
+    printf("path %d: %d packets to B (%d lost), %d to A (%d lost), busy %.1f%% of the time to B\n",
+           i, paths[i].sent[B], paths[i].lost[B], paths[i].sent[A], paths[i].lost[A],
+           simtime > 0.0 ? 100.0 * paths[i].busy[B] / simtime : 0.0);
+  printf("%s scheduler, resequencer at B: %d packets held, %d gaps given up, %d packets late\n",
+         schedname[scheduler], reseq.nreordered, reseq.nskipped, reseq.nlate);
+  if (nlatencies == 0)
+    return;
+  qsort(latencies, nlatencies, sizeof(float), cmpfloat);
+  for (i=0; i<nlatencies; i++)
+    sum += latencies[i];
+  printf("delivery latency: mean %.2f, median %.2f, 95th percentile %.2f, 99th %.2f, max %.2f\n",
+         sum / nlatencies, latencies[nlatencies/2], latencies[(int)(0.95*(nlatencies-1))],
+         latencies[(int)(0.99*(nlatencies-1))], latencies[nlatencies-1]);
+}
+#endif
+
+/********************* MESSAGE LOG ***********************/
+
+/* note that message id was accepted by A at time sent */
+void logmessage(int id, float sent)
+{
+  struct msgrecord *bigger;
+  int i;
+
+  if (msglog_count == msglog_size) {
+    bigger = malloc(sizeof(struct msgrecord) * (msglog_size ? 2*msglog_size : 64));
+    if (bigger == 0) {
+      printf("memory allocation for message log failed.");
+      exit(EXIT_FAILURE);
+    }
+    for (i=0; i<msglog_count; i++)
+      bigger[i] = msglog[(msglog_head + i) % msglog_size];
+    free(msglog);
+    msglog = bigger;
+    msglog_head = 0;
+    msglog_size = msglog_size ? 2*msglog_size : 64;
+  }
+  msglog[(msglog_head + msglog_count) % msglog_size].id = id;
+  msglog[(msglog_head + msglog_count) % msglog_size].sent = sent;
+  msglog_count++;
+}
+
+/* take the oldest undelivered message off the log into *r.  Returns 0 if
+   every accepted message has already been delivered */
+int unlogmessage(struct msgrecord *r)
+{
+  if (msglog_count == 0)
+    return 0;
+  *r = msglog[msglog_head];
+  msglog_head = (msglog_head + 1) % msglog_size;
+  msglog_count--;
+  return 1;
+}
+
+#ifdef FLOWCONTROL
+/* B's application will read the oldest unread message */
+static void scheduleread(void)
+{
+  struct event *evptr;
+
+  evptr = malloc(sizeof(struct event));
+  if (evptr == 0) {
+    printf("memory allocation for event failed.");
+    exit(EXIT_FAILURE);
+  }
+  evptr->evtime = simtime + readtime*jimsrand()*2;
+  evptr->evtype = APP_READ;
+  evptr->eventity = B;
+  evptr->pktptr = NULL;
+  schedule(evptr);
+}
+
+/* B's application has read a message */
+void appread(void)
+{
+  if (TRACE>2)
+    printf("          APP_READ: %d messages left unread at B\n", unread - 1);
+  if (--unread > 0)
+    scheduleread();
+}
+#endif
+
+/* a message was delivered to layer 5 at B */
+void delivered(const char datasent[PAYLOADSIZE])
+{
+  struct msgrecord r;
+#ifdef REGRESS
+  int id;
+
+  memcpy(&id, datasent, sizeof(id));
+  if (!unlogmessage(&r) || r.id != id) {
+    misdelivered();           /* duplicate, out of order or never sent */
+    return;
+  }
+#else
+  (void)datasent;             /* only the regression suite checks which */
+
+  if (!unlogmessage(&r))
+    return;
+#endif
+#ifdef STEADYSTATE
+  recorddelivery(simtime - r.sent);
+#endif
+#ifdef SCENARIO
+  episodedelivered(r.id);
+#endif
+#ifdef MULTIPATH
+  recordlatency(simtime - r.sent);
+#endif
+}
+
+void tolayer5(int AorB, const char datasent[PAYLOADSIZE])
+{
+  int i;  
+  if (TRACE>2) {
+    printf("          TOLAYER5: data received by application at ");
+    if (AorB == A) 
+      printf("A: ");
+    else
+      printf("B: ");
+    for (i=0; i<PAYLOADSIZE; i++)  
+      printf("%c",datasent[i]);
+    printf("\n");
+  }
+  messages_delivered++;
+  if (msglog_on && AorB == B)
+    delivered(datasent);
+#ifdef FLOWCONTROL
+  if (AorB == B) {
+    if (unread == rcvbufsize) {
+      printf("INTERNAL PANIC: B delivered a message with no room for it, see rcvroom()\n");
+      exit(EXIT_FAILURE);
+    }
+    if (unread++ == 0)
+      scheduleread();
+  }
+#endif
+}
+
+int rcvroom(int AorB)
+{
+#ifdef FLOWCONTROL
+  if (AorB == B)
+    return rcvbufsize - unread;
+#else
+  (void)AorB;
+#endif
+  return INT_MAX;
+}
+
+#ifdef CHECKPOINT
+/********************* CHECKPOINTS ***********************/
+/* A checkpoint is the complete state of a run: the event list, clock,
+   random number state, statistics and the protocol's own state.  It can
+   be saved to a file and later loaded in place of the warm-up of a new
+   run, which then continues with the parameters entered for that run.
+   In fork mode the run is instead forked at the checkpoint time into
+   variants with their own loss and corruption probabilities, so the
+   common prefix is simulated only once.  Every variant continues from
+   the same random number state. */
+
+#define  NO_CHECKPOINT   0
+#define  SAVE_CHECKPOINT 1
+#define  LOAD_CHECKPOINT 2
+#define  FORK_CHECKPOINT 3
+#define  MAXVARIANTS     64
+#define  CKPTNAMELEN     16   /* bytes kept for the protocol's name */
+
+#define  SAVE(x)  ckpt_write(&(x), sizeof(x))
+#define  LOAD(x)  ckpt_read(&(x), sizeof(x))
+
+static const char ckptmagic[8] = "EMUCKPT2";
+
+/* features compiled in that change what a checkpoint holds.  A checkpoint
+   records them with the protocol's name and is only loaded by a build of
+   the same protocol with the same features */
+#define  CKPT_FEC         0x01
+#define  CKPT_MULTIPATH   0x02
+#define  CKPT_STEADYSTATE 0x04
+#define  CKPT_FLOWCONTROL 0x08
+#define  CKPT_SCENARIO    0x10
+#define  CKPT_PARALLEL    0x20
+
+static int ckptfeatures(void)
+{
+  int f = 0;
+
+#ifdef FEC
+  f |= CKPT_FEC;
+#endif
+#ifdef MULTIPATH
+  f |= CKPT_MULTIPATH;
+#endif
+#ifdef STEADYSTATE
+  f |= CKPT_STEADYSTATE;
+#endif
+#ifdef FLOWCONTROL
+  f |= CKPT_FLOWCONTROL;
+#endif
+#ifdef SCENARIO
+  f |= CKPT_SCENARIO;
+#endif
+#ifdef PARALLEL
+  f |= CKPT_PARALLEL;
+#endif
+  return f;
+}
+
+static int   ckptmode = NO_CHECKPOINT;
+static float ckpttime;            /* take the checkpoint after this time */
+static char  ckptname[256];
+static int   nvariants;
+static float variantloss[MAXVARIANTS];
+static float variantcorrupt[MAXVARIANTS];
+static int   variant = -1;        /* variant run by this process, -1 if none */
+
+void askcheckpoint(void)
+{
+  int i;
+
+  printf("Enter checkpoint mode [0 none, 1 save, 2 restore, 3 fork variants]:");
+  scanf("%d",&ckptmode);
+  if (ckptmode == SAVE_CHECKPOINT || ckptmode == FORK_CHECKPOINT) {
+    printf("Enter the time to take the checkpoint at:");
+    scanf("%f",&ckpttime);
+  }
+  if (ckptmode == SAVE_CHECKPOINT || ckptmode == LOAD_CHECKPOINT) {
+    printf("Enter the checkpoint file name:");
+    scanf("%255s",ckptname);
+  }
+  if (ckptmode == FORK_CHECKPOINT) {
+    printf("Enter the number of variants [1 to %d]:", MAXVARIANTS);
+    scanf("%d",&nvariants);
+    if (nvariants < 1 || nvariants > MAXVARIANTS) {
+      printf("number of variants must be between 1 and %d\n", MAXVARIANTS);
+      exit(EXIT_FAILURE);
+    }
+    for (i=0; i<nvariants; i++) {
+      printf("Enter packet loss probability for variant %d:", i);
+      scanf("%f",&variantloss[i]);
+      printf("Enter packet corruption probability for variant %d:", i);
+      scanf("%f",&variantcorrupt[i]);
+    }
+  }
+#ifdef PARALLEL
+  if (ckptmode != NO_CHECKPOINT && nthreads > 1) {
+    printf("checkpoints need A and B to run serially\n");
+    exit(EXIT_FAILURE);
+  }
+#endif
+}
+
+void savecheckpoint(void)
+{
+  struct event *q;
+  char name[CKPTNAMELEN];
+  long offset;
+  int n;
+
+  ckpt_open(ckptname, 1);
+  ckpt_write(ckptmagic, sizeof(ckptmagic));
+  memset(name, 0, sizeof(name));
+  strncpy(name, protocolname, sizeof(name)-1);
+  SAVE(name);
+  n = ckptfeatures();
+  SAVE(n);
+  n = sizeof(struct pkt);
+  SAVE(n);
+
+  SAVE(simtime);
+  SAVE(nsim);
+  SAVE(window_full);
+  SAVE(total_ACKs_received);
+  SAVE(packets_resent);
+  SAVE(fast_retransmits);
+  SAVE(window_probes);
+  SAVE(new_ACKs);
+  SAVE(packets_received);
+  SAVE(messages_delivered);
+  SAVE(ntolayer3);
+  SAVE(nlost);
+  SAVE(ncorrupt);
+  SAVE(lastarrival);
+  SAVE(linkbusy);
+#ifdef PARALLEL
+  SAVE(rngstate);
+#else
+  SAVE(rngdraws);
+#endif
+  SAVE(onoff_end);
+  SAVE(saturatedtime);
+  SAVE(saturateddelivered);
+  SAVE(saturatedbusy);
+#ifdef FLOWCONTROL
+  SAVE(unread);
+#endif
+  offset = trace_next - trace_start;
+  SAVE(offset);
+  SAVE(msglog_count);
+  for (n=0; n<msglog_count; n++)
+    SAVE(msglog[(msglog_head + n) % msglog_size]);
+#ifdef FEC
+  SAVE(fec);                      /* the held packets follow */
+  for (n=0; n<FECMAXK; n++)
+    ckpt_writepkt(fec.held[n]);
+#endif
+#ifdef SCENARIO
+  SAVE(scenario);
+#endif
+#ifdef MULTIPATH
+  SAVE(paths);
+  SAVE(txseq);
+  SAVE(reseq);                    /* the held packets follow */
+  for (n=0; n<RESEQSIZE; n++)
+    ckpt_writepkt(reseq.held[n].pktptr);
+  SAVE(nlatencies);
+  for (n=0; n<nlatencies; n++)
+    SAVE(latencies[n]);
+#endif
+
+  for (n=0, q=evlist; q!=NULL; q=q->next)
+    n++;
+  SAVE(n);
+  for (q=evlist; q!=NULL; q=q->next) {
+    SAVE(q->evtime);
+    SAVE(q->evtype);
+    SAVE(q->eventity);
+    SAVE(q->evcreated);
+    SAVE(q->evcreator);
+#ifdef FEC
+    SAVE(q->fecgroup);
+    SAVE(q->fecslot);
+#endif
+#ifdef SCENARIO
+    SAVE(q->episode);
+#endif
+#ifdef MULTIPATH
+    SAVE(q->path);
+    SAVE(q->pathseq);
+#endif
+    if (q->evtype == FROM_LAYER3)
+      ckpt_writepkt(q->pktptr);
+  }
+
+  A_save();
+  B_save();
+  ckpt_close();
+  printf("          CHECKPOINT: saved at time %f to %s\n", simtime, ckptname);
+}
+
+void loadcheckpoint(void)
+{
+  struct event *q, *last;
+  char magic[sizeof(ckptmagic)];
+  char name[CKPTNAMELEN];
+  struct msgrecord r;
+#ifndef PARALLEL
+  unsigned long draws;
+#endif
+  long offset;
+  int i, n;
+#ifdef MULTIPATH
+  float f;
+#endif
+
+  /* throw away the events init() scheduled */
+  while ((q = nextevent()) != NULL) {
+    if (q->evtype == FROM_LAYER3)
+      pkt_release(q->pktptr);
+    free(q);
+  }
+
+  ckpt_open(ckptname, 0);
+  ckpt_read(magic, sizeof(magic));
+  if (memcmp(magic, ckptmagic, sizeof(magic)) != 0) {
+    printf("%s is not a checkpoint of this emulator build\n", ckptname);
+    exit(EXIT_FAILURE);
+  }
+  LOAD(name);
+  name[sizeof(name)-1] = '\0';
+  if (strcmp(name, protocolname) != 0) {
+    printf("%s was saved by the %s protocol, not %s\n", ckptname, name, protocolname);
+    exit(EXIT_FAILURE);
+  }
+  LOAD(n);
+  if (n != ckptfeatures()) {
+    printf("%s was saved by a build with other features (%#x, not %#x)\n", ckptname, n, ckptfeatures());
+    exit(EXIT_FAILURE);
+  }
+  LOAD(n);
+  if (n != (int)sizeof(struct pkt)) {
+    printf("%s is not a checkpoint of this emulator build\n", ckptname);
+    exit(EXIT_FAILURE);
+  }
+
+  LOAD(simtime);
+  LOAD(nsim);
+  LOAD(window_full);
+  LOAD(total_ACKs_received);
+  LOAD(packets_resent);
+  LOAD(fast_retransmits);
+  LOAD(window_probes);
+  LOAD(new_ACKs);
+  LOAD(packets_received);
+  LOAD(messages_delivered);
+  LOAD(ntolayer3);
+  LOAD(nlost);
+  LOAD(ncorrupt);
+  LOAD(lastarrival);
+  LOAD(linkbusy);
+#ifdef PARALLEL
+  LOAD(rngstate);
+#else
+  LOAD(draws);
+  srand(9999);
+  for (rngdraws=0; rngdraws<draws; rngdraws++)
+    rand();
+#endif
+  LOAD(onoff_end);
+  LOAD(saturatedtime);
+  LOAD(saturateddelivered);
+  LOAD(saturatedbusy);
+#ifdef FLOWCONTROL
+  LOAD(unread);
+#endif
+  LOAD(offset);
+  if (trace_start != NULL)
+    trace_next = trace_start + offset;
+  LOAD(n);
+  msglog_count = 0;
+  for (i=0; i<n; i++) {
+    LOAD(r);
+    logmessage(r.id, r.sent);
+  }
+#ifdef FEC
+  LOAD(fec);
+  for (i=0; i<FECMAXK; i++)
+    fec.held[i] = ckpt_readpkt();
+#endif
+#ifdef SCENARIO
+  LOAD(scenario);
+#endif
+#ifdef MULTIPATH
+  LOAD(paths);
+  LOAD(txseq);
+  LOAD(reseq);
+  for (i=0; i<RESEQSIZE; i++)
+    reseq.held[i].pktptr = ckpt_readpkt();
+  LOAD(n);
+  nlatencies = 0;
+  for (i=0; i<n; i++) {
+    LOAD(f);
+    recordlatency(f);
+  }
+#endif
+
+  LOAD(n);
+  for (i=0, last=NULL; i<n; i++) {
+    q = malloc(sizeof(struct event));
+    if (q == 0) {
+      printf("memory allocation for event failed.");
+      exit(EXIT_FAILURE);
+    }
+    LOAD(q->evtime);
+    LOAD(q->evtype);
+    LOAD(q->eventity);
+    LOAD(q->evcreated);
+    LOAD(q->evcreator);
+#ifdef FEC
+    LOAD(q->fecgroup);
+    LOAD(q->fecslot);
+#endif
+#ifdef SCENARIO
+    LOAD(q->episode);
+#endif
+#ifdef MULTIPATH
+    LOAD(q->path);
+    LOAD(q->pathseq);
+#endif
+    q->pktptr = q->evtype == FROM_LAYER3 ? ckpt_readpkt() : NULL;
+    q->prev = last;           /* events were saved in list order */
+    q->next = NULL;
+    if (last == NULL)
+      evlist = q;
+    else
+      last->next = q;
+    last = q;
+  }
+
+  A_load();
+  B_load();
+  ckpt_close();
+  printf("          CHECKPOINT: restored time %f from %s\n", simtime, ckptname);
+}
+
+/* fork one process per variant.  Returns in each child with that
+   variant's parameters set; the parent waits for them all and exits,
+   with a failure if any of them failed */
+void forkvariants(void)
+{
+  pid_t pid[MAXVARIANTS];
+  int i, status, nfailed = 0;
+
+  fflush(stdout);
+  for (i=0; i<nvariants; i++) {
+    pid[i] = fork();
+    if (pid[i] < 0) {
+      printf("unable to fork variant %d\n", i);
+      exit(EXIT_FAILURE);
+    }
+    if (pid[i] == 0) {
+      variant = i;
+      lossprob = variantloss[i];
+      corruptprob = variantcorrupt[i];
+      return;
+    }
+  }
+  for (i=0; i<nvariants; i++)
+    if (waitpid(pid[i], &status, 0) < 0 || !WIFEXITED(status) ||
+        WEXITSTATUS(status) != EXIT_SUCCESS) {
+      printf("variant %d failed\n", i);
+      nfailed++;
+    }
+  exit(nfailed == 0 ? EXIT_SUCCESS : EXIT_FAILURE);
+}
+
+/* called before the first event after the checkpoint time */
+void takecheckpoint(void)
+{
+  if (ckptmode == SAVE_CHECKPOINT)
+    savecheckpoint();
+  else if (ckptmode == FORK_CHECKPOINT)
+    forkvariants();
+  ckptmode = NO_CHECKPOINT;
+}
+#endif
+
+#ifdef STEADYSTATE
+/********************* STEADY STATE DETECTION ***********************/
+/* The run is cut into batches of batchlen time units, recording the
+   messages delivered and their total latency in each.  After every batch
+   the initial transient is found with the MSER rule: drop the first d
+   batches, where d (at most half of them) minimises the squared standard
+   error of the mean goodput of the rest.  The remaining batches are
+   grouped into NBATCHES batch means, which give confidence intervals for
+   goodput and latency.  The run stops as soon as both intervals are
+   within the requested relative precision. */
+
+#define NBATCHES    20      /* batch means in a confidence interval */
+#define TQUANTILE   2.093   /* t(0.975) with NBATCHES-1 degrees of freedom */
+#define MINBATCHES  100     /* batches to see before stopping */
+
+static float  precision;         /* relative half-width to stop at */
+static float  batchlen;          /* length of a batch in time units */
+static float  batchend;          /* end of the current batch */
+static double curdelivered, curlatency;  /* of the current batch */
+static double *batchdelivered, *batchlatency;
+static int    nbatches, maxbatches;
+static int    warmup;            /* batches deleted as transient */
+static int    converged;
+static double goodput, goodput_half, latency, latency_half;
+
+void asksteadystate(void)
+{
+  printf("Enter the relative precision to stop at [e.g. 0.05]:");
+  scanf("%f",&precision);
+  printf("Enter the batch length in time units [ > 0.0]:");
+  scanf("%f",&batchlen);
+#ifdef PARALLEL
+  if (nthreads > 1) {
+    printf("steady state detection needs A and B to run serially\n");
+    exit(EXIT_FAILURE);
+  }
+#endif
+  msglog_on = 1;
+}
+
+void recorddelivery(double latency)
+{
+  curdelivered++;
+  curlatency += latency;
+}
+
+/* MSER truncation point of the goodput batches */
+static int mser(void)
+{
+  double sum = 0.0, sumsq = 0.0, x, best = -1.0, score;
+  int d, m, bestd = 0;
+
+  /* walk back from the last batch keeping suffix sums */
+  for (d=nbatches-1; d>=0; d--) {
+    x = batchdelivered[d];
+    sum += x;
+    sumsq += x*x;
+    m = nbatches - d;
+    if (d <= nbatches/2) {
+      score = (sumsq - sum*sum/m) / ((double)m*m);
+      if (best < 0.0 || score <= best) {
+        best = score;
+        bestd = d;
+      }
+    }
+  }
+  return bestd;
+}
+
+/* confidence intervals from the batches after the warm-up.  Returns 0 if
+   there are not yet enough batches with deliveries */
+static int intervals(void)
+{
+  double gp[NBATCHES], lat[NBATCHES];
+  double delivered, lsum, sgp, slat;
+  int size, first, b, i;
+
+  size = (nbatches - warmup) / NBATCHES;
+  if (size < 1)
+    return 0;
+  first = nbatches - size*NBATCHES;   /* any remainder goes with the warm-up */
+  goodput = latency = 0.0;
+  for (b=0; b<NBATCHES; b++) {
+    delivered = lsum = 0.0;
+    for (i=first + b*size; i<first + (b+1)*size; i++) {
+      delivered += batchdelivered[i];
+      lsum += batchlatency[i];
+    }
+    if (delivered == 0.0)
+      return 0;
+    gp[b] = delivered / (size*batchlen);
+    lat[b] = lsum / delivered;
+    goodput += gp[b] / NBATCHES;
+    latency += lat[b] / NBATCHES;
+  }
+  sgp = slat = 0.0;
+  for (b=0; b<NBATCHES; b++) {
+    sgp += (gp[b] - goodput)*(gp[b] - goodput);
+    slat += (lat[b] - latency)*(lat[b] - latency);
+  }
+  goodput_half = TQUANTILE*sqrt(sgp/(NBATCHES-1)/NBATCHES);
+  latency_half = TQUANTILE*sqrt(slat/(NBATCHES-1)/NBATCHES);
+  return 1;
+}
+
+/* close the batches that end before time t.  Returns 1 once the
+   estimates have reached the requested precision */
+int closebatches(float t)
+{
+  while (t > batchend) {
+    if (nbatches == maxbatches) {
+      maxbatches = maxbatches ? 2*maxbatches : 1024;
+      batchdelivered = realloc(batchdelivered, maxbatches*sizeof(double));
+      batchlatency = realloc(batchlatency, maxbatches*sizeof(double));
+      if (batchdelivered == 0 || batchlatency == 0) {
+        printf("memory allocation for batches failed.");
+        exit(EXIT_FAILURE);
+      }
+    }
+    batchdelivered[nbatches] = curdelivered;
+    batchlatency[nbatches] = curlatency;
+    nbatches++;
+    curdelivered = curlatency = 0.0;
+    batchend += batchlen;
+
+    if (nbatches >= MINBATCHES) {
+      warmup = mser();
+      if (intervals() && goodput_half <= precision*goodput &&
+          latency_half <= precision*latency) {
+        converged = 1;
+        return 1;
+      }
+    }
+  }
+  return 0;
+}
+
+void reportsteadystate(void)
+{
+  if (nbatches >= NBATCHES) {
+    warmup = mser();
+    if (!intervals())
+      goodput = goodput_half = latency = latency_half = 0.0;
+  }
+  if (converged)
+    printf("steady state estimates reached precision %f at time %f\n", precision, simtime);
+  else
+    printf("steady state estimates did not reach precision %f before the run ended\n", precision);
+  printf("warm-up deleted:  %f time units (%d of %d batches)\n", warmup*batchlen, warmup, nbatches);
+  printf("goodput:  %f +- %f messages per time unit (95%% confidence)\n", goodput, goodput_half);
+  printf("latency:  %f +- %f time units (95%% confidence)\n", latency, latency_half);
+}
+#endif
+
+#ifdef REGRESS
+/********************* REGRESSION SUITE ***********************/
+/* Runs the protocol over a grid of loss and corruption probabilities,
+   corruption directions and arrival rates, each point in its own process
+   started from the same seed, and compares goodput, resends, messages
+   dropped at a full window and messages delivered with a baseline file.
+   A point fails if any of them is worse than the baseline by more than
+   the relative tolerance, or if a message is delivered out of order,
+   twice, or not at all.  Record mode runs the built-in grid and writes
+   the baseline file instead. */
+
+#define CHECK_BASELINE  0
+#define RECORD_BASELINE 1
+
+struct gridpoint {
+  int   messages;
+  float loss, corrupt;
+  int   direction;
+  float lambda;
+  float goodput;                /* messages delivered per time unit */
+  int   resent, full, delivered;
+  int   misordered, undelivered;
+};
+
+static float gridloss[]    = { 0.0, 0.1, 0.3 };
+static float gridcorrupt[] = { 0.0, 0.1, 0.3 };
+static float gridlambda[]  = { 10.0, 20.0, 50.0 };
+
+static int   regressmode;
+static char  baselinename[256];
+static float tolerance;
+static int   misordered;
+
+void askregress(void)
+{
+  printf("Enter the baseline file name:");
+  scanf("%255s",baselinename);
+  printf("Enter 0 to check against the baseline, 1 to record it:");
+  scanf("%d",&regressmode);
+  if (regressmode == CHECK_BASELINE) {
+    printf("Enter the relative tolerance [e.g. 0.05]:");
+    scanf("%f",&tolerance);
+  }
+#ifdef PARALLEL
+  if (nthreads > 1) {
+    printf("the regression suite runs A and B serially\n");
+    exit(EXIT_FAILURE);
+  }
+#endif
+}
+
+void misdelivered(void)
+{
+  misordered++;
+}
+
+static int resultfd = -1;       /* pipe to the parent, in a grid point's process */
+
+/* run one grid point in a child process.  Returns in the child with the
+   point's parameters set; the parent reads back its results */
+static int rungridpoint(struct gridpoint *g)
+{
+  int fd[2], status;
+  ssize_t n;
+  pid_t pid;
+  struct event *q;
+
+  fflush(NULL);                 /* or the child would write out our buffers too */
+  if (pipe(fd) < 0 || (pid = fork()) < 0) {
+    printf("unable to start grid point\n");
+    exit(EXIT_FAILURE);
+  }
+  if (pid == 0) {
+    close(fd[0]);
+    resultfd = fd[1];
+    nsimmax = g->messages;
+    lossprob = g->loss;
+    corruptprob = g->corrupt;
+    corruptdirection = g->direction;
+    lambda = g->lambda;
+    while ((q = nextevent()) != NULL)   /* arrival scheduled by init() */
+      free(q);
+    srand(9999);
+    rngdraws = 0;
+    startarrivals();
+    msglog_on = 1;
+    return 1;
+  }
+  close(fd[1]);
+  n = read(fd[0], g, sizeof(*g));
+  close(fd[0]);
+  if (waitpid(pid, &status, 0) < 0 || !WIFEXITED(status) ||
+      WEXITSTATUS(status) != EXIT_SUCCESS || n != sizeof(*g)) {
+    printf("grid point loss %f corrupt %f direction %d lambda %f did not finish\n",
+           g->loss, g->corrupt, g->direction, g->lambda);
+    g->misordered = g->undelivered = -1;
+  }
+  return 0;
+}
+
+/* in a grid point's process, at the end of its run */
+void reportgridpoint(void)
+{
+  struct gridpoint g;
+
+  g.messages = nsimmax;
+  g.loss = lossprob;
+  g.corrupt = corruptprob;
+  g.direction = corruptdirection;
+  g.lambda = lambda;
+  g.goodput = simtime > 0.0 ? messages_delivered / simtime : 0.0;
+  g.resent = packets_resent + fast_retransmits;
+  g.full = window_full;
+  g.delivered = messages_delivered;
+  g.misordered = misordered;
+  g.undelivered = msglog_count;
+  fflush(stdout);
+  /* _exit() leaves the parent's baseline file, shared with us, alone */
+  _exit(write(resultfd, &g, sizeof(g)) == sizeof(g) ? EXIT_SUCCESS : EXIT_FAILURE);
+}
+
+/* worse than the baseline by more than the tolerance? */
+static int worse(double now, double base, int higherisbetter)
+{
+  if (higherisbetter)
+    return now < base*(1.0 - tolerance);
+  return now > base*(1.0 + tolerance);
+}
+
+/* the number of points in the grid, as recordbaseline() runs it */
+static int gridsize(void)
+{
+  size_t l, c;
+  int n = 0;
+
+  for (l=0; l<sizeof(gridloss)/sizeof(float); l++)
+    for (c=0; c<sizeof(gridcorrupt)/sizeof(float); c++)
+      n += (gridloss[l] == 0.0 && gridcorrupt[c] == 0.0 ? 1 : 3) *
+           (int)(sizeof(gridlambda)/sizeof(float));
+  return n;
+}
+
+static void recordbaseline(void)
+{
+  struct gridpoint g;
+  FILE *f;
+  size_t l, c, r;
+  int d;
+
+  f = fopen(baselinename, "w");
+  if (f == NULL) {
+    printf("unable to write baseline %s\n", baselinename);
+    exit(EXIT_FAILURE);
+  }
+  fprintf(f, "# messages loss corrupt direction lambda goodput resent full delivered\n");
+  for (l=0; l<sizeof(gridloss)/sizeof(float); l++)
+    for (c=0; c<sizeof(gridcorrupt)/sizeof(float); c++)
+      for (d=0; d<3; d++)
+        for (r=0; r<sizeof(gridlambda)/sizeof(float); r++) {
+          if (gridloss[l] == 0.0 && gridcorrupt[c] == 0.0 && d > 0)
+            continue;         /* direction only matters with loss or corruption */
+          g.messages = nsimmax;
+          g.loss = gridloss[l];
+          g.corrupt = gridcorrupt[c];
+          g.direction = d;
+          g.lambda = gridlambda[r];
+          if (rungridpoint(&g))
+            return;
+          if (g.misordered != 0 || g.undelivered != 0) {
+            printf("loss %f corrupt %f direction %d lambda %f: %d misdelivered, %d undelivered\n",
+                   g.loss, g.corrupt, g.direction, g.lambda, g.misordered, g.undelivered);
+            exit(EXIT_FAILURE);
+          }
+          /* 9 digits are enough for goodput to read back as the same float */
+          fprintf(f, "%d %f %f %d %f %.9g %d %d %d\n", g.messages, g.loss, g.corrupt,
+                  g.direction, g.lambda, g.goodput, g.resent, g.full, g.delivered);
+        }
+  fclose(f);
+  printf("baseline recorded in %s\n", baselinename);
+  exit(EXIT_SUCCESS);
+}
+
+static void checkbaseline(void)
+{
+  struct gridpoint g, base;
+  char line[256];
+  FILE *f;
+  int npoints = 0, nfailed = 0, failed;
+
+  f = fopen(baselinename, "r");
+  if (f == NULL) {
+    printf("unable to read baseline %s\n", baselinename);
+    exit(EXIT_FAILURE);
+  }
+  while (fgets(line, sizeof(line), f) != NULL) {
+    if (line[0] == '#')
+      continue;
+    if (sscanf(line, "%d %f %f %d %f %f %d %d %d", &base.messages, &base.loss,
+               &base.corrupt, &base.direction, &base.lambda, &base.goodput,
+               &base.resent, &base.full, &base.delivered) != 9) {
+      printf("FAIL unreadable baseline line: %s", line);
+      nfailed++;              /* a damaged baseline must not pass */
+      continue;
+    }
+    g = base;
+    if (rungridpoint(&g)) {
+      fclose(f);
+      return;
+    }
+    failed = g.misordered != 0 || g.undelivered != 0 ||
+             worse(g.goodput, base.goodput, 1) || worse(g.resent, base.resent, 0) ||
+             worse(g.full, base.full, 0) || worse(g.delivered, base.delivered, 1);
+    printf("%s loss %.2f corrupt %.2f direction %d lambda %5.1f: goodput %f (%f) resent %d (%d) full %d (%d) delivered %d (%d)",
+           failed ? "FAIL" : "ok  ", g.loss, g.corrupt, g.direction, g.lambda,
+           g.goodput, base.goodput, g.resent, base.resent, g.full, base.full,
+           g.delivered, base.delivered);
+    if (g.misordered != 0 || g.undelivered != 0)
+      printf(" misdelivered %d undelivered %d", g.misordered, g.undelivered);
+    printf("\n");
+    npoints++;
+    nfailed += failed;
+  }
+  fclose(f);
+  if (npoints != gridsize()) {
+    printf("FAIL %s holds %d grid points, the grid has %d\n", baselinename, npoints, gridsize());
+    nfailed++;
+  }
+  printf("%d of %d grid points worse than %s\n", nfailed, npoints, baselinename);
+  exit(nfailed == 0 ? EXIT_SUCCESS : EXIT_FAILURE);
+}
+
+/* returns only in the process of a grid point */
+void runregress(void)
+{
+  if (regressmode == RECORD_BASELINE)
+    recordbaseline();
+  else
+    checkbaseline();
+}
+#endif
+
+#ifdef TUNE
+/********************* AUTOMATIC TUNING ***********************/
+/* Searches for the sender window and retransmission timeout with the
+   highest goodput on the profile entered (loss, corruption, direction and
+   arrival process).  The window is found by golden-section search over
+   1 to the largest window asked for, and for each window the timeout by
+   golden-section search over the range asked for, so goodput is taken to
+   be unimodal in each.  Every setting is run a number of times, each in
+   its own process, replication r from seed 9999+r whatever the setting.
+   Settings are compared on these common random numbers, which makes the
+   differences between their goodputs far less noisy than the goodputs.
+   The report gives the best setting tried with a 95% confidence interval
+   for its goodput, and the windows and timeouts of the settings that are
+   not significantly worse. */
+
+#define MAXREPS       32        /* replications of a setting */
+#define MAXSETTINGS   1024      /* settings tried in one search */
+#define TIMEOUTSTEPS  12        /* golden-section steps over the timeout */
+#define GOLDEN        0.6180339887498949
+
+struct setting {
+  int    window;
+  double timeout;
+  double goodput[MAXREPS];      /* messages delivered per time unit, by replication */
+  double mean;
+};
+
+/* t(0.975) with 1 to MAXREPS-1 degrees of freedom */
+static const double tquantile[MAXREPS] = { 0.0,
+  12.706, 4.303, 3.182, 2.776, 2.571, 2.447, 2.365, 2.306, 2.262, 2.228,
+  2.201,  2.179, 2.160, 2.145, 2.131, 2.120, 2.110, 2.101, 2.093, 2.086,
+  2.080,  2.074, 2.069, 2.064, 2.060, 2.056, 2.052, 2.048, 2.045, 2.042,
+  2.040 };
+
+static int    nreps;
+static int    largestwindow;
+static double shortesttimeout, longesttimeout;
+static struct setting settings[MAXSETTINGS];
+static int    nsettings;
+
+void asktune(void)
+{
+  printf("Enter the number of replications of each setting [2-%d]:", MAXREPS);
+  scanf("%d",&nreps);
+  printf("Enter the largest window to try:");
+  scanf("%d",&largestwindow);
+  printf("Enter the shortest and the longest timeout to try:");
+  scanf("%lf %lf",&shortesttimeout,&longesttimeout);
+  if (nreps < 2 || nreps > MAXREPS) {
+    printf("the tuner needs 2 to %d replications\n", MAXREPS);
+    exit(EXIT_FAILURE);
+  }
+  if (largestwindow < 1 || shortesttimeout <= 0.0 || longesttimeout < shortesttimeout) {
+    printf("no windows or timeouts to try\n");
+    exit(EXIT_FAILURE);
+  }
+  if (largestwindow > A_maxwindow()) {
+    printf("the protocol takes windows up to %d\n", A_maxwindow());
+    exit(EXIT_FAILURE);
+  }
+#ifdef PARALLEL
+  if (nthreads > 1) {
+    printf("the tuner runs A and B serially\n");
+    exit(EXIT_FAILURE);
+  }
+#endif
+}
+
+static int resultfd = -1;       /* pipe to the parent, in a replication's process */
+
+/* run replication r of a setting in a child process.  Returns in the
+   child with the setting and seed in place; the parent reads back its
+   goodput */
+static int runreplication(struct setting *s, int r)
+{
+  int fd[2], status;
+  ssize_t n;
+  pid_t pid;
+  struct event *q;
+
+  fflush(NULL);                 /* or the child would write out our buffers too */
+  if (pipe(fd) < 0 || (pid = fork()) < 0) {
+    printf("unable to start a replication\n");
+    exit(EXIT_FAILURE);
+  }
+  if (pid == 0) {
+    close(fd[0]);
+    resultfd = fd[1];
+    windowsize = s->window;
+    rto = s->timeout;
+    while ((q = nextevent()) != NULL)   /* arrival scheduled by init() */
+      free(q);
+    srand(9999 + r);
+    rngdraws = 0;
+    startarrivals();
+    return 1;
+  }
+  close(fd[1]);
+  n = read(fd[0], &s->goodput[r], sizeof(double));
+  close(fd[0]);
+  if (waitpid(pid, &status, 0) < 0 || !WIFEXITED(status) ||
+      WEXITSTATUS(status) != EXIT_SUCCESS || n != sizeof(double)) {
+    printf("window %d timeout %f replication %d did not finish\n", s->window, s->timeout, r);
+    exit(EXIT_FAILURE);
+  }
+  return 0;
+}
+
+/* in a replication's process, at the end of its run */
+void reporttune(void)
+{
+  double goodput;
+
+  goodput = simtime > 0.0 ? messages_delivered / simtime : 0.0;
+  fflush(stdout);
+  _exit(write(resultfd, &goodput, sizeof(goodput)) == sizeof(goodput) ? EXIT_SUCCESS : EXIT_FAILURE);
+}
+
+/* the results of a setting, running its replications if it has not been
+   tried yet.  NULL in a replication's process */
+static struct setting *evaluate(int window, double timeout)
+{
+  struct setting *s;
+  int r;
+
+  for (s = settings; s < settings + nsettings; s++)
+    if (s->window == window && s->timeout == timeout)
+      return s;
+  if (nsettings == MAXSETTINGS) {
+    printf("more than %d settings tried\n", MAXSETTINGS);
+    exit(EXIT_FAILURE);
+  }
+  s = &settings[nsettings++];
+  s->window = window;
+  s->timeout = timeout;
+  s->mean = 0.0;
+  for (r=0; r<nreps; r++) {
+    if (runreplication(s, r))
+      return NULL;
+    s->mean += s->goodput[r] / nreps;
+  }
+  return s;
+}
+
+/* golden-section search for the best timeout with this window.  Returns 0
+   in a replication's process */
+static int searchtimeout(int window)
+{
+  struct setting *c, *d;
+  double a = shortesttimeout, b = longesttimeout;
+  int i;
+
+  if ((c = evaluate(window, b - GOLDEN*(b - a))) == NULL ||
+      (d = evaluate(window, a + GOLDEN*(b - a))) == NULL)
+    return 0;
+  for (i=0; i<TIMEOUTSTEPS; i++) {
+    if (c->mean >= d->mean) {   /* the best is in [a, d] */
+      b = d->timeout;
+      d = c;
+      if ((c = evaluate(window, b - GOLDEN*(b - a))) == NULL)
+        return 0;
+    }
+    else {                      /* in [c, b] */
+      a = c->timeout;
+      c = d;
+      if ((d = evaluate(window, a + GOLDEN*(b - a))) == NULL)
+        return 0;
+    }
+  }
+  return 1;
+}
+
+/* the best setting tried with this window */
+static struct setting *bestwith(int window)
+{
+  struct setting *s, *best = NULL;
+
+  for (s = settings; s < settings + nsettings; s++)
+    if ((window == 0 || s->window == window) && (best == NULL || s->mean > best->mean))
+      best = s;
+  return best;
+}
+
+/* golden-section search over the windows, each at its best timeout, down
+   to three and then all of those.  Returns 0 in a replication's process */
+static int searchwindow(void)
+{
+  int a = 1, b = largestwindow, c, d, w;
+
+  while (b - a > 2) {
+    c = a + (int)((1.0 - GOLDEN)*(b - a));
+    d = b - (int)((1.0 - GOLDEN)*(b - a));
+    if (!searchtimeout(c) || !searchtimeout(d))
+      return 0;
+    if (bestwith(c)->mean >= bestwith(d)->mean)
+      b = d;
+    else
+      a = c;
+  }
+  for (w=a; w<=b; w++)
+    if (!searchtimeout(w))
+      return 0;
+  return 1;
+}
+
+/* mean of x[0..nreps-1] and the half width of its 95% confidence interval */
+static double halfwidth(const double *x, double *mean)
+{
+  double sum = 0.0, sumsq = 0.0;
+  int r;
+
+  for (r=0; r<nreps; r++)
+    sum += x[r];
+  *mean = sum / nreps;
+  for (r=0; r<nreps; r++)
+    sumsq += (x[r] - *mean) * (x[r] - *mean);
+  return tquantile[nreps-1] * sqrt(sumsq / (nreps - 1) / nreps);
+}
+
+/* returns only in the process of a replication */
+void runtune(void)
+{
+  struct setting *s, *best;
+  double diff[MAXREPS], mean, half, lowtimeout, hightimeout;
+  int r, n = 0, lowwindow, highwindow;
+
+  if (!searchwindow())
+    return;
+  best = bestwith(0);
+  lowwindow = highwindow = best->window;
+  lowtimeout = hightimeout = best->timeout;
+  for (s = settings; s < settings + nsettings; s++) {
+    for (r=0; r<nreps; r++)
+      diff[r] = best->goodput[r] - s->goodput[r];
+    if (s != best && halfwidth(diff, &mean) < mean)
+      continue;                 /* worse with 95% confidence */
+    n++;
+    if (s->window < lowwindow)
+      lowwindow = s->window;
+    if (s->window > highwindow)
+      highwindow = s->window;
+    if (s->timeout < lowtimeout)
+      lowtimeout = s->timeout;
+    if (s->timeout > hightimeout)
+      hightimeout = s->timeout;
+  }
+  half = halfwidth(best->goodput, &mean);
+  printf("tuned for loss %f corruption %f direction %d lambda %f over %d messages\n",
+         lossprob, corruptprob, corruptdirection, lambda, nsimmax);
+  printf("%d settings tried, %d replications each\n", nsettings, nreps);
+  printf("best:  window %d timeout %f goodput %f +- %f messages per time unit (95%% confidence)\n",
+         best->window, best->timeout, best->mean, half);
+  printf("%d settings not significantly worse (95%%, paired): windows %d to %d, timeouts %f to %f\n",
+         n, lowwindow, highwindow, lowtimeout, hightimeout);
+  exit(EXIT_SUCCESS);
+}
+#endif
+
+/* fill in the next message from layer 5 */
+static void makemessage(struct msg *m)
+{
+  int i, j;
+
+  /* fill in msg to give with string of same letter */
+  j = nsim % 26;
+  for (i=0; i<PAYLOADSIZE; i++)
+    m->data[i] = 97 + j;
+#ifdef REGRESS
+  memcpy(m->data, &nsim, sizeof(nsim));  /* checked on delivery */
+#endif
+  if (TRACE>2) {
+    printf("          MAINLOOP: data given to student: ");
+    for (i=0; i<PAYLOADSIZE; i++)
+      printf("%c", m->data[i]);
+    printf("\n");
+  }
+  nsim++;
+}
+
+/* with SATURATED_ARRIVALS, A is handed as many messages as its window
+   takes after each of its events, so it is never short of data.  The
+   goodput and the share of time the medium from A to B is busy, up to
+   the time the last message was handed over, are the sustained maximum
+   of the configuration */
+void saturate(void)
+{
+  struct msg m;
+  int n;
+
+  if (nsim == nsimmax)
+    return;
+  for (n = A_windowspace(); n > 0 && nsim < nsimmax; n--) {
+    makemessage(&m);
+    A_output_ref(&m);
+    if (msglog_on)
+      logmessage(nsim - 1, simtime);
+  }
+  if (nsim == nsimmax) {
+    saturatedtime = simtime;
+    saturateddelivered = messages_delivered;
+    saturatedbusy = linkbusy[B];
+  }
+}
+
+void reportsaturated(void)
+{
+  if (saturatedtime <= 0.0)
+    return;
+  printf("saturated source: %f messages delivered per time unit, medium to B busy %.1f%% of the time\n",
+         saturateddelivered / saturatedtime, 100.0 * saturatedbusy / saturatedtime);
+}
+
+/* hand a packet that came out of the medium to its entity */
+void frommedium(struct event *eventptr)
+{
+  if (eventptr->eventity ==A)      /* deliver packet by calling */
+    A_input_ref(eventptr->pktptr); /* appropriate entity */
+#ifdef FEC
+  else if (fecreceive(eventptr))   /* parity, or held until the gap */
+    ;                              /* before it is filled */
+#endif
+  else
+    B_input_ref(eventptr->pktptr);
+  pkt_release(eventptr->pktptr);   /* drop the event's reference */
+}
+
+/* run one event taken off the event list */
+void dispatch(struct event *eventptr)
+{
+  static struct msg msg2give[BURSTSIZE];
+  int i,j,k;
+
+  if (TRACE>=2) {
+    printf("\nEVENT time: %f,",eventptr->evtime);
+    printf("  type: %d",eventptr->evtype);
+    if (eventptr->evtype==0)
+      printf(", timerinterrupt  ");
+    else if (eventptr->evtype==1)
+      printf(", fromlayer5 ");
+    else if (eventptr->evtype==FROM_LAYER3)
+      printf(", fromlayer3 ");
+    else if (eventptr->evtype==FEC_DEADLINE)
+      printf(", fecdeadline ");
+    else if (eventptr->evtype==EPISODE)
+      printf(", episode ");
+    else if (eventptr->evtype==APP_READ)
+      printf(", appread ");
+    else
+      printf(", reseqdeadline ");
+    printf(" entity: %d\n",eventptr->eventity);
+  }
+  simtime = eventptr->evtime;     /* update time to next event time */
+  curentity = eventptr->eventity;
+  if (eventptr->evtype == FROM_LAYER5 ) {
+    if (ARRIVALS == SATURATED_ARRIVALS)
+      ;                          /* handed over by saturate() below */
+    else if (nsim < nsimmax) {
+      generate_next_arrival();   /* set up future arrival */
+      for (k=0; k<BURSTSIZE && nsim<nsimmax; k++)
+        makemessage(&msg2give[k]);
+      if (eventptr->eventity == A) {
+        j = window_full;
+        if (BURSTSIZE > 1)
+          A_outputv(msg2give, k);
+        else
+          A_output_ref(&msg2give[0]);  
+        /* A takes the first messages of a burst that fit in its window */
+        if (msglog_on)
+          for (i=0; i<k - (window_full - j); i++)
+            logmessage(nsim - k + i, simtime);
+      }
+      else
+        for (i=0; i<k; i++)
+          B_output(msg2give[i]);  
+    }
+    else if (TRACE > 2)
+        printf("          FROM_LAYER5: no more messages to send: \n");
+  }
+  else if (eventptr->evtype ==  FROM_LAYER3) {
+#ifdef MULTIPATH
+    if (eventptr->eventity == B)
+      resequence(eventptr);          /* passes B its packets in order */
+    else
+#endif
+    frommedium(eventptr);
+  }
+#ifdef FEC
+  else if (eventptr->evtype == FEC_DEADLINE)
+    fecdeadline(eventptr->fecgroup);
+#endif
+#ifdef SCENARIO
+  else if (eventptr->evtype == EPISODE)
+    episode(eventptr->episode);
+#endif
+#ifdef FLOWCONTROL
+  else if (eventptr->evtype == APP_READ)
+    appread();
+#endif
+#ifdef MULTIPATH
+  else if (eventptr->evtype == RESEQ_DEADLINE)
+    reseqdeadline();
+#endif
+  else if (eventptr->evtype ==  TIMER_INTERRUPT) {
+    if (eventptr->eventity == A) 
+      A_timerinterrupt();
+    else
+      B_timerinterrupt();
+  }
+  else  {
+    printf("INTERNAL PANIC: unknown event type \n");
+  }
+  if (ARRIVALS == SATURATED_ARRIVALS && eventptr->eventity == A)
+    saturate();                  /* fill the room the event made */
+  free(eventptr);
+}
+
+#ifdef PARALLEL
+/********************* PARALLEL EXECUTION ***********************/
+/* A and B run their own events on their own threads.  A packet spends at
+   least LOOKAHEAD time units in the medium, so if T is the time of the
+   earliest pending event, nothing either side does before T+LOOKAHEAD can
+   affect the other before T+LOOKAHEAD.  Each thread runs its events in
+   that window, the packets sent across are handed over at a barrier, and
+   the next window starts.  As each entity has its own random number
+   stream and ties between events are broken by fixed rules, the results
+   are exactly those of the serial run of the same build (TRACE output
+   from the two threads is interleaved, though). */
+
+#define LOOKAHEAD 1.0f     /* least delay of a packet in the medium */
+
+static struct event *outbox[2];      /* events sent across by A and B in this window */
+static struct event **outtail[2];
+static struct event *initial[2];     /* events scheduled before the threads started */
+static float nexttime[2];            /* earliest pending event of A and B */
+static float finaltime[2];           /* time of the last event run by A and B */
+static int barrier_waiting;
+static int barrier_phase;
+
+/* queue an event for the other partition, delivered at the next barrier */
+static void sendpartition(struct event *p)
+{
+  p->next = NULL;
+  *outtail[curentity] = p;
+  outtail[curentity] = &p->next;
+}
+
+/* wait for the other thread.  The window is usually only a few events
+   long, so spin for a while before giving up the processor */
+static void barrier(void)
+{
+  int phase = __atomic_load_n(&barrier_phase, __ATOMIC_ACQUIRE);
+  int spins = 0;
+
+  if (__atomic_add_fetch(&barrier_waiting, 1, __ATOMIC_ACQ_REL) == 2) {
+    __atomic_store_n(&barrier_waiting, 0, __ATOMIC_RELAXED);
+    __atomic_store_n(&barrier_phase, phase + 1, __ATOMIC_RELEASE);
+    return;
+  }
+  while (__atomic_load_n(&barrier_phase, __ATOMIC_ACQUIRE) == phase)
+    if (++spins > 1000)
+      sched_yield();
+}
+
+static void *partition(void *arg)
+{
+  int me = (int)(intptr_t)arg;
+  struct event *eventptr;
+  float T, W;
+
+  curentity = me;
+  evlist = initial[me];
+  finaltime[me] = 0.0;
+  while (1) {
+    nexttime[me] = evlist != NULL ? evlist->evtime : INFINITY;
+    barrier();
+    T = nexttime[A] < nexttime[B] ? nexttime[A] : nexttime[B];
+    if (T == INFINITY)
+      break;
+    W = T + LOOKAHEAD;
+    while (evlist != NULL && evlist->evtime < W) {
+      eventptr = nextevent();
+      finaltime[me] = eventptr->evtime;
+      dispatch(eventptr);
+    }
+    barrier();
+
+    /* take the packets the other side sent in this window */
+    while ((eventptr = outbox[1-me]) != NULL) {
+      outbox[1-me] = eventptr->next;
+      insertevent(eventptr);
+    }
+    outtail[1-me] = &outbox[1-me];
+  }
+  return NULL;
+}
+
+void runparallel(void)
+{
+  pthread_t thread[2];
+  struct event *eventptr, *last[2];
+  int i;
+
+  /* hand each thread the events already scheduled for it */
+  for (i=A; i<=B; i++) {
+    initial[i] = last[i] = NULL;
+    outbox[i] = NULL;
+    outtail[i] = &outbox[i];
+  }
+  while ((eventptr = nextevent()) != NULL) {
+    i = eventptr->eventity;
+    eventptr->prev = last[i];
+    eventptr->next = NULL;
+    if (last[i] == NULL)
+      initial[i] = eventptr;
+    else
+      last[i]->next = eventptr;
+    last[i] = eventptr;
+  }
+
+  for (i=A; i<=B; i++)
+    if (pthread_create(&thread[i], NULL, partition, (void *)(intptr_t)i) != 0) {
+      printf("unable to start thread.");
+      exit(EXIT_FAILURE);
+    }
+  for (i=A; i<=B; i++)
+    pthread_join(thread[i], NULL);
+  simtime = finaltime[A] > finaltime[B] ? finaltime[A] : finaltime[B];
+}
+#endif
+
+int main(void)
+{
+  init();
+#ifdef REGRESS
+  runregress();
+#endif
+#ifdef TUNE
+  runtune();
+#endif
+  A_init();
+  B_init();
+#ifdef CHECKPOINT
+  if (ckptmode == LOAD_CHECKPOINT) {
+    loadcheckpoint();
+    ckptmode = NO_CHECKPOINT;
+  }
+#endif
+#ifdef STEADYSTATE
+  batchend = simtime + batchlen;
+#endif
+   
+#ifdef PARALLEL
+  if (nthreads > 1)
+    runparallel();
+  else
+#endif
+  while (evlist != NULL) {
+#ifdef CHECKPOINT
+    if (ckptmode != NO_CHECKPOINT && evlist->evtime > ckpttime)
+      takecheckpoint();
+#endif
+#ifdef STEADYSTATE
+    if (closebatches(evlist->evtime))
+      break;                        /* precise enough, stop early */
+#endif
+    dispatch(nextevent());          /* get next event to simulate */
+  }
+#ifdef CHECKPOINT
+  if (ckptmode != NO_CHECKPOINT)    /* the run ended before the checkpoint time */
+    takecheckpoint();
+  if (variant >= 0)
+    printf("Variant %d: loss probability %f, corruption probability %f\n",
+           variant, lossprob, corruptprob);
+#endif
+#ifdef REGRESS
+  reportgridpoint();
+#endif
+#ifdef TUNE
+  reporttune();
+#endif
+
+  printf(" Simulator terminated at time %f\n after attempting to send %d msgs from layer5\n",simtime,nsim);
+  printf("number of messages dropped due to full window:  %d \n", window_full);
+  printf("number of valid (not corrupt or duplicate) acknowledgements received at A:  %d \n", new_ACKs);
+  printf("(note: a single acknowledgement may have acknowledged more than one packet - if cumulative acknowledgements are used)\n");
+  printf("number of packet resends by A:  %d \n", packets_resent);
+  if (fast_retransmits > 0)
+    printf("number of packets fast retransmitted by A:  %d \n", fast_retransmits);
+  if (window_probes > 0)
+    printf("number of zero window probes sent by A:  %d \n", window_probes);
+  printf("number of correct packets received at B:  %d \n", packets_received);
+  printf("number of messages delivered to application:  %d \n", messages_delivered);
+  reportsaturated();
+#ifdef FEC
+  reportfec();
+#endif
+#ifdef SCENARIO
+  reportscenario();
+#endif
+#ifdef MULTIPATH
+  reportmultipath();
+#endif
+#ifdef STEADYSTATE
+  reportsteadystate();
+#endif
+  return EXIT_SUCCESS;
+}
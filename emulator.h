@@ -3,6 +3,8 @@ extern int TRACE;
 /* statistics updated by GBN */
 extern int total_ACKs_received;
 extern int packets_resent;       /* count of the number of packets resent  */
+extern int fast_retransmits;     /* packets resent before their timeout (duplicate ACKs, NAKs), not in packets_resent */
+extern int window_probes;        /* packets sent by A into a closed receive window */
 extern int new_ACKs;      /* count of the number of acks correctly received */
 extern int packets_received;  /* count of the packets received by receiver */
 extern int window_full; /* count of the number of messages dropped due to full window */
@@ -10,11 +12,18 @@ extern int window_full; /* count of the number of messages dropped due to full w
 #define   A    0
 #define   B    1
 
+/* number of bytes of application data carried by a msg and a pkt.  The
+   assignment uses 20; build with e.g. -DPAYLOADSIZE=1460 to model
+   realistic segment sizes */
+#ifndef PAYLOADSIZE
+#define PAYLOADSIZE 20
+#endif
+
 /* a "msg" is the data unit passed from layer 5 (teachers code) to layer  */
 /* 4 (students' code).  It contains the data (characters) to be delivered */
 /* to layer 5 via the students transport level protocol entities.         */
 struct msg {
-  char data[20];
+  char data[PAYLOADSIZE];
 };
 
 /* a packet is the data unit passed from layer 4 (students code) to layer */
@@ -24,14 +33,41 @@ struct pkt {
   int seqnum;
   int acknum;
   int checksum;
-  char payload[20];
+  char payload[PAYLOADSIZE];
 };
 
 /* send to A or B (int), packet to send */
 extern void tolayer3(int, struct pkt);  
 
+/* packet buffers for the zero-copy path.  pkt_alloc() returns a packet
+   holding one reference; pkt_hold() adds a reference and pkt_release()
+   drops one, recycling the buffer when the last reference goes. */
+extern struct pkt *pkt_alloc(void);
+extern const struct pkt *pkt_hold(const struct pkt *);
+extern void pkt_release(const struct pkt *);
+
+/* send to A or B (int), packet to send.  Layer 3 takes its own reference
+   instead of copying, so the packet must not be modified afterwards */
+extern void tolayer3_ref(int, const struct pkt *);
+
+/* checkpoint files.  The protocol's A_save()/B_save() write its state
+   with ckpt_write() and ckpt_writepkt(), and A_load()/B_load() read it
+   back in the same order with ckpt_read() and ckpt_readpkt() */
+extern void ckpt_open(const char *, int);
+extern void ckpt_close(void);
+extern void ckpt_write(const void *, int);
+extern void ckpt_read(void *, int);
+extern void ckpt_writepkt(const struct pkt *);
+extern struct pkt *ckpt_readpkt(void);
+
 /* deliver to A or B (int), data to deliver */
-extern void tolayer5(int, char[20]); 
+extern void tolayer5(int, const char[PAYLOADSIZE]); 
+
+/* the number of messages tolayer5() can take now at A or B (int).  With
+   -DFLOWCONTROL B's application reads them at a limited rate from a
+   buffer of limited size, and a protocol must not deliver more; without
+   it there is always room */
+extern int rcvroom(int);
 
 /* start timer at A or B (int), increment */
 extern void starttimer(int, double);       
@@ -1,6 +1,8 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
 #include "emulator.h"
 #include "gbn.h"
 
@@ -23,31 +25,73 @@
 **********************************************************************/
 
 #define RTT  16.0       /* round trip time.  MUST BE SET TO 16.0 when submitting assignment */
-#define WINDOWSIZE 6    /* the maximum number of buffered unacked packet */
-#define SEQSPACE 7      /* the min sequence space for GBN must be at least windowsize + 1 */
+#ifndef WINDOWSIZE
+#define WINDOWSIZE 6    /* default maximum number of buffered unacked packets */
+#endif
 #define NOTINUSE (-1)   /* used to fill header fields that are not being used */
 
+/* resend the window after this many duplicate ACKs in a row, without
+   waiting for the timeout.  0 turns fast retransmit off.  As in NewReno,
+   it fires once until everything sent before the last resend (fast or
+   on a timeout) is ACKed; if a resent packet is lost too, A waits for
+   the timeout however many more duplicates come */
+#ifndef FASTRETRANSMIT
+#define FASTRETRANSMIT 0
+#endif
+
+/* with -DFLOWCONTROL, B's ACKs carry the number of packets after acknum
+   that it has room for (rcvroom()) in their payload, and A sends no
+   further than that.  Packets A holds back wait in its window; when all
+   it has sent is ACKed and the window is still closed, its timer sends
+   the next one anyway as a probe, so a lost window update cannot stall
+   it.  B drops a packet it has no room for and repeats its last ACK */
+#ifndef FLOWCONTROL
+#define FLOWCONTROL 0
+#endif
+#if FLOWCONTROL && PAYLOADSIZE < 4
+#error "flow control carries the receive window in the ACK payload"
+#endif
+
+/* the maximum number of buffered unacked packets and the timeout.  Can
+   be changed before A_init() is called, the window up to MAXWINDOW */
+int windowsize = WINDOWSIZE;
+double rto = RTT;
+
+const char protocolname[] = "gbn";
+
+/* sequence numbers use all 32 bits and wrap around, so they are compared
+   with serial number arithmetic (RFC 1982): a is before b if b - a, taken
+   mod 2^32, is less than 2^31.  This holds as long as the window is less
+   than half the sequence space */
+#define MAXWINDOW 0x40000000
+
+/* how far sequence number a is after b, negative if a is before b */
+static int SeqDiff(int a, int b)
+{
+  return (int32_t)((uint32_t)a - (uint32_t)b);
+}
+
 /* generic procedure to compute the checksum of a packet.  Used by both sender and receiver  
    the simulator will overwrite part of your packet with 'z's.  It will not overwrite your 
    original checksum.  This procedure must generate a different checksum to the original if
    the packet is corrupted.
 */
-int ComputeChecksum(struct pkt packet)
+int ComputeChecksum(const struct pkt *packet)
 {
-  int checksum = 0;
+  uint32_t checksum = 0;   /* unsigned, so large sequence numbers wrap */
   int i;
 
-  checksum = packet.seqnum;
-  checksum += packet.acknum;
-  for ( i=0; i<20; i++ ) 
-    checksum += (int)(packet.payload[i]);
+  checksum = (uint32_t)packet->seqnum;
+  checksum += (uint32_t)packet->acknum;
+  for ( i=0; i<PAYLOADSIZE; i++ ) 
+    checksum += (int)(packet->payload[i]);
 
-  return checksum;
+  return (int)checksum;
 }
 
-bool IsCorrupted(struct pkt packet)
+bool IsCorrupted(const struct pkt *packet)
 {
-  if (packet.checksum == ComputeChecksum(packet))
+  if (packet->checksum == ComputeChecksum(packet))
     return (false);
   else
     return (true);
@@ -56,106 +100,206 @@ bool IsCorrupted(struct pkt packet)
 
 /********* Sender (A) variables and functions ************/
 
-static struct pkt buffer[WINDOWSIZE];  /* array for storing packets waiting for ACK */
-static int windowfirst, windowlast;    /* array indexes of the first/last packet awaiting ACK */
-static int windowcount;                /* the number of packets currently awaiting an ACK */
-static int A_nextseqnum;               /* the next sequence number to be used by the sender */
+static struct pkt **buffer;    /* windowsize packets waiting for ACK, used as a ring */
+static int buffersize;         /* size of buffer, windowsize when A_init() was called */
+static int windowfirst;        /* array index of the first packet awaiting ACK */
+static int windowcount;        /* the number of packets currently awaiting an ACK */
+static int A_nextseqnum;       /* the next sequence number to be used by the sender */
+static int A_nextsend;         /* the first packet in the window not sent yet */
+static int sendlimit;          /* the first sequence number B has no room for */
+static int dupacks;            /* duplicate ACKs received since the last new one */
+static int recover;            /* A_nextseqnum when the window was last resent */
 
 /* called from layer 5 (application layer), passed the message to be sent to other side */
 void A_output(struct msg message)
 {
-  struct pkt sendpkt;
-  int i;
+  A_output_ref(&message);
+}
+
+void A_output_ref(const struct msg *message)
+{
+  A_outputv(message, 1);
+}
+
+/* send the next packet of the window */
+static void SendNext(void)
+{
+  const struct pkt *sendpkt;
+  int seqfirst = (int)((uint32_t)A_nextseqnum - windowcount);
 
-  /* if not blocked waiting on ACK */
-  if ( windowcount < WINDOWSIZE) {
+  sendpkt = buffer[(windowfirst + SeqDiff(A_nextsend, seqfirst)) % buffersize];
+  if (TRACE > 0)
+    printf("Sending packet %d to layer 3\n", sendpkt->seqnum);
+  tolayer3_ref (A, sendpkt);
+  A_nextsend = (int)((uint32_t)A_nextsend + 1);
+}
+
+/* send the packets of the window B has room for.  Returns true if the
+   first of them was sent, when nothing else was awaiting an ACK */
+static bool SendWindow(void)
+{
+  bool wasidle = (A_nextsend == (int)((uint32_t)A_nextseqnum - windowcount));
+  bool sent = false;
+
+  while (SeqDiff(A_nextsend, A_nextseqnum) < 0 &&
+         (!FLOWCONTROL || SeqDiff(A_nextsend, sendlimit) < 0)) {
+    SendNext();
+    sent = true;
+  }
+  return wasidle && sent;
+}
+
+/* called from layer 5 with a burst of messages.  As many as fit in the
+   window are sent back to back, the rest are dropped */
+void A_outputv(const struct msg *messages, int n)
+{
+  struct pkt *sendpkt;
+  bool wasempty = (windowcount == 0);
+  int i, k;
+
+  /* while not blocked waiting on ACK */
+  for (k=0; k<n && windowcount < buffersize; k++) {
     if (TRACE > 1)
       printf("----A: New message arrives, send window is not full, send new messge to layer3!\n");
 
     /* create packet */
-    sendpkt.seqnum = A_nextseqnum;
-    sendpkt.acknum = NOTINUSE;
-    for ( i=0; i<20 ; i++ ) 
-      sendpkt.payload[i] = message.data[i];
-    sendpkt.checksum = ComputeChecksum(sendpkt); 
-
-    /* put packet in window buffer */
-    /* windowlast will always be 0 for alternating bit; but not for GoBackN */
-    windowlast = (windowlast + 1) % WINDOWSIZE; 
-    buffer[windowlast] = sendpkt;
+    sendpkt = pkt_alloc();
+    sendpkt->seqnum = A_nextseqnum;
+    sendpkt->acknum = NOTINUSE;
+    for ( i=0; i<PAYLOADSIZE ; i++ ) 
+      sendpkt->payload[i] = messages[k].data[i];
+    sendpkt->checksum = ComputeChecksum(sendpkt); 
+
+    /* put packet in window buffer, which keeps the reference from pkt_alloc */
+    buffer[(windowfirst + windowcount) % buffersize] = sendpkt;
     windowcount++;
 
-    /* send out packet */
-    if (TRACE > 0)
-      printf("Sending packet %d to layer 3\n", sendpkt.seqnum);
-    tolayer3 (A, sendpkt);
-
-    /* start timer if first packet in window */
-    if (windowcount == 1)
-      starttimer(A,RTT);
+    /* get next sequence number, wraps back to 0 after 2^32 */
+    A_nextseqnum = (int)((uint32_t)A_nextseqnum + 1);
 
-    /* get next sequence number, wrap back to 0 */
-    A_nextseqnum = (A_nextseqnum + 1) % SEQSPACE;  
+    /* send out packet, if B has room for it */
+    SendWindow();
   }
+
+  /* start timer if the first packet in window was sent */
+  if (wasempty && windowcount > 0)
+    starttimer(A,rto);
+
   /* if blocked,  window is full */
-  else {
+  for (; k<n; k++) {
     if (TRACE > 0)
       printf("----A: New message arrives, send window is full\n");
     window_full++;
   }
 }
 
+/* the number of messages that fit in the window now */
+int A_windowspace(void)
+{
+  return buffersize - windowcount;
+}
+
+/* the largest window A_init() accepts */
+int A_maxwindow(void)
+{
+  return MAXWINDOW;
+}
+
 
 /* called from layer 3, when a packet arrives for layer 4 
    In this practical this will always be an ACK as B never sends data.
 */
 void A_input(struct pkt packet)
+{
+  A_input_ref(&packet);
+}
+
+void A_input_ref(const struct pkt *packet)
 {
   int ackcount = 0;
+  int seqfirst;
+  int room, limit;
+  bool dupack = true;    /* may count towards a fast retransmit */
   int i;
 
   /* if received ACK is not corrupted */ 
   if (!IsCorrupted(packet)) {
     if (TRACE > 0)
-      printf("----A: uncorrupted ACK %d is received\n",packet.acknum);
+      printf("----A: uncorrupted ACK %d is received\n",packet->acknum);
     total_ACKs_received++;
 
-    /* check if new ACK or duplicate */
+    /* B's receive window starts after the packet it ACKs.  B's limit
+       never moves back: its room only shrinks by the packets it
+       delivers.  So a limit behind the one A has comes from an ACK
+       overtaken by a later one, as ACKs on different paths can be.  As in
+       TCP, an ACK is only a duplicate if it leaves B's limit as it was
+       and A is not probing a closed window: B answers a refused probe
+       with the same ACK, and that is no sign of a loss */
+    if (FLOWCONTROL) {
+      memcpy(&room, packet->payload, sizeof(room));
+      limit = (int)((uint32_t)packet->acknum + 1 + room);
+      dupack = (limit == sendlimit && SeqDiff(A_nextsend, sendlimit) <= 0);
+      if (SeqDiff(limit, sendlimit) > 0)
+        sendlimit = limit;
+    }
+
+    /* check if new ACK or duplicate: the window holds the windowcount
+       sequence numbers before A_nextseqnum */
+    seqfirst = (int)((uint32_t)A_nextseqnum - windowcount);
     if (windowcount != 0) {
-          int seqfirst = buffer[windowfirst].seqnum;
-          int seqlast = buffer[windowlast].seqnum;
-          /* check case when seqnum has and hasn't wrapped */
-          if (((seqfirst <= seqlast) && (packet.acknum >= seqfirst && packet.acknum <= seqlast)) ||
-              ((seqfirst > seqlast) && (packet.acknum >= seqfirst || packet.acknum <= seqlast))) {
+          if (SeqDiff(packet->acknum, seqfirst) >= 0 && SeqDiff(packet->acknum, A_nextsend) < 0) {
 
             /* packet is a new ACK */
             if (TRACE > 0)
-              printf("----A: ACK %d is not a duplicate\n",packet.acknum);
+              printf("----A: ACK %d is not a duplicate\n",packet->acknum);
             new_ACKs++;
+            dupacks = 0;
 
             /* cumulative acknowledgement - determine how many packets are ACKed */
-            if (packet.acknum >= seqfirst)
-              ackcount = packet.acknum + 1 - seqfirst;
-            else
-              ackcount = SEQSPACE - seqfirst + packet.acknum;
-
-	    /* slide window by the number of packets ACKed */
-            windowfirst = (windowfirst + ackcount) % WINDOWSIZE;
+            ackcount = SeqDiff(packet->acknum, seqfirst) + 1;
 
             /* delete the acked packets from window buffer */
-            for (i=0; i<ackcount; i++)
-              windowcount--;
+            for (i=0; i<ackcount; i++) {
+              pkt_release(buffer[(windowfirst + i) % buffersize]);
+              buffer[(windowfirst + i) % buffersize] = NULL;
+            }
+
+	    /* slide window by the number of packets ACKed */
+            windowfirst = (windowfirst + ackcount) % buffersize;
+            windowcount -= ackcount;
+            SendWindow();
 
 	    /* start timer again if there are still more unacked packets in window */
             stoptimer(A);
             if (windowcount > 0)
-              starttimer(A, RTT);
+              starttimer(A, rto);
 
           }
+          else if (FASTRETRANSMIT > 0 && SeqDiff(packet->acknum, seqfirst) == -1 && dupack &&
+                   ++dupacks == FASTRETRANSMIT && SeqDiff(seqfirst, recover) >= 0) {
+            /* B keeps acking the packet before our base, which it must have
+               lost.  Unless the window was resent since the base was sent:
+               then the duplicates may be B's answers to the copies */
+            if (TRACE > 0)
+              printf("----A: %d duplicate ACKs received, fast retransmit!\n", dupacks);
+            for (i=0; i<SeqDiff(A_nextsend, seqfirst); i++) {
+              tolayer3_ref(A, buffer[(windowfirst + i) % buffersize]);
+              fast_retransmits++;
+            }
+            recover = A_nextsend;
+            stoptimer(A);
+            starttimer(A, rto);
+          }
         }
         else
           if (TRACE > 0)
         printf ("----A: duplicate ACK received, do nothing!\n");
+
+    /* a window update lets A send packets it held back */
+    if (FLOWCONTROL && ackcount == 0 && windowcount != 0 && SendWindow()) {
+      stoptimer(A);
+      starttimer(A, rto);
+    }
   }
   else 
     if (TRACE > 0)
@@ -165,19 +309,31 @@ void A_input(struct pkt packet)
 /* called when A's timer goes off */
 void A_timerinterrupt(void)
 {
-  int i;
+  int i, sent;
+
+  /* everything sent is ACKed, but B's window is closed: probe it */
+  sent = SeqDiff(A_nextsend, (int)((uint32_t)A_nextseqnum - windowcount));
+  if (sent == 0) {
+    if (TRACE > 0)
+      printf("----A: time out with the receive window closed, send probe!\n");
+    SendNext();
+    window_probes++;
+    starttimer(A,rto);
+    return;
+  }
 
   if (TRACE > 0)
     printf("----A: time out,resend packets!\n");
+  recover = A_nextsend;
 
-  for(i=0; i<windowcount; i++) {
+  for(i=0; i<sent; i++) {
 
     if (TRACE > 0)
-      printf ("---A: resending packet %d\n", (buffer[(windowfirst+i) % WINDOWSIZE]).seqnum);
+      printf ("---A: resending packet %d\n", buffer[(windowfirst+i) % buffersize]->seqnum);
 
-    tolayer3(A,buffer[(windowfirst+i) % WINDOWSIZE]);
+    tolayer3_ref(A,buffer[(windowfirst+i) % buffersize]);
     packets_resent++;
-    if (i==0) starttimer(A,RTT);
+    if (i==0) starttimer(A,rto);
   }
 }       
 
@@ -187,14 +343,68 @@ void A_timerinterrupt(void)
 /* entity A routines are called. You can use it to do any initialization */
 void A_init(void)
 {
+  int i;
+
+  /* drop any packets still held from a previous run */
+  for (i=0; i<buffersize; i++)
+    pkt_release(buffer[i]);
+  free(buffer);
+
+  if (windowsize < 1 || windowsize > MAXWINDOW) {
+    printf("window size must be between 1 and %d\n", MAXWINDOW);
+    exit(EXIT_FAILURE);
+  }
+  buffersize = windowsize;
+  buffer = calloc(buffersize, sizeof(struct pkt *));
+  if (buffer == NULL) {
+    printf("memory allocation for the send window failed.");
+    exit(EXIT_FAILURE);
+  }
+
   /* initialise A's window, buffer and sequence number */
   A_nextseqnum = 0;  /* A starts with seq num 0, do not change this */
+  A_nextsend = 0;
+  sendlimit = 1;          /* B has room for one packet until it says more */
   windowfirst = 0;
-  windowlast = -1;   /* windowlast is where the last packet sent is stored.  
-		     new packets are placed in winlast + 1 
-		     so initially this is set to -1
-		   */
   windowcount = 0;
+  dupacks = 0;
+  recover = 0;
+}
+
+/* write A's state to a checkpoint */
+void A_save(void)
+{
+  int i;
+
+  ckpt_write(&buffersize, sizeof(buffersize));
+  ckpt_write(&A_nextseqnum, sizeof(A_nextseqnum));
+  ckpt_write(&A_nextsend, sizeof(A_nextsend));
+  ckpt_write(&sendlimit, sizeof(sendlimit));
+  ckpt_write(&windowfirst, sizeof(windowfirst));
+  ckpt_write(&windowcount, sizeof(windowcount));
+  ckpt_write(&dupacks, sizeof(dupacks));
+  ckpt_write(&recover, sizeof(recover));
+  for (i=0; i<windowcount; i++)
+    ckpt_writepkt(buffer[(windowfirst + i) % buffersize]);
+}
+
+/* read back A's state saved by A_save() */
+void A_load(void)
+{
+  int i;
+
+  /* the window the checkpoint was taken with */
+  ckpt_read(&windowsize, sizeof(windowsize));
+  A_init();
+  ckpt_read(&A_nextseqnum, sizeof(A_nextseqnum));
+  ckpt_read(&A_nextsend, sizeof(A_nextsend));
+  ckpt_read(&sendlimit, sizeof(sendlimit));
+  ckpt_read(&windowfirst, sizeof(windowfirst));
+  ckpt_read(&windowcount, sizeof(windowcount));
+  ckpt_read(&dupacks, sizeof(dupacks));
+  ckpt_read(&recover, sizeof(recover));
+  for (i=0; i<windowcount; i++)
+    buffer[(windowfirst + i) % buffersize] = ckpt_readpkt();
 }
 
 
@@ -208,47 +418,61 @@ static int B_nextseqnum;   /* the sequence number for the next packets sent by B
 /* called from layer 3, when a packet arrives for layer 4 at B*/
 void B_input(struct pkt packet)
 {
-  struct pkt sendpkt;
+  B_input_ref(&packet);
+}
+
+void B_input_ref(const struct pkt *packet)
+{
+  struct pkt *sendpkt;
+  int room;
   int i;
 
-  /* if not corrupted and received packet is in order */
-  if  ( (!IsCorrupted(packet))  && (packet.seqnum == expectedseqnum) ) {
+  sendpkt = pkt_alloc();
+
+  /* if not corrupted, received packet is in order and there is room for it */
+  if  ( (!IsCorrupted(packet))  && (packet->seqnum == expectedseqnum) && (!FLOWCONTROL || rcvroom(B) > 0) ) {
     if (TRACE > 0)
-      printf("----B: packet %d is correctly received, send ACK!\n",packet.seqnum);
+      printf("----B: packet %d is correctly received, send ACK!\n",packet->seqnum);
     packets_received++;
 
     /* deliver to receiving application */
-    tolayer5(B, packet.payload);
+    tolayer5(B, packet->payload);
 
     /* send an ACK for the received packet */
-    sendpkt.acknum = expectedseqnum;
+    sendpkt->acknum = expectedseqnum;
 
     /* update state variables */
-    expectedseqnum = (expectedseqnum + 1) % SEQSPACE;        
+    expectedseqnum = (int)((uint32_t)expectedseqnum + 1);        
   }
   else {
-    /* packet is corrupted or out of order resend last ACK */
+    /* packet is corrupted, out of order or B has no room for it: resend
+       last ACK.  Before the first packet this is 2^32 - 1, which A sees
+       as before its window */
     if (TRACE > 0) 
       printf("----B: packet corrupted or not expected sequence number, resend ACK!\n");
-    if (expectedseqnum == 0)
-      sendpkt.acknum = SEQSPACE - 1;
-    else
-      sendpkt.acknum = expectedseqnum - 1;
+    sendpkt->acknum = (int)((uint32_t)expectedseqnum - 1);
   }
 
   /* create packet */
-  sendpkt.seqnum = B_nextseqnum;
+  sendpkt->seqnum = B_nextseqnum;
   B_nextseqnum = (B_nextseqnum + 1) % 2;
     
   /* we don't have any data to send.  fill payload with 0's */
-  for ( i=0; i<20 ; i++ ) 
-    sendpkt.payload[i] = '0';  
+  for ( i=0; i<PAYLOADSIZE ; i++ ) 
+    sendpkt->payload[i] = '0';  
+
+  /* advertise the room left for the packets after the ACKed one */
+  if (FLOWCONTROL) {
+    room = rcvroom(B) < MAXWINDOW ? rcvroom(B) : MAXWINDOW;
+    memcpy(sendpkt->payload, &room, sizeof(room));
+  }
 
   /* computer checksum */
-  sendpkt.checksum = ComputeChecksum(sendpkt); 
+  sendpkt->checksum = ComputeChecksum(sendpkt); 
 
-  /* send out packet */
-  tolayer3 (B, sendpkt);
+  /* send out packet, layer 3 keeps its own reference */
+  tolayer3_ref (B, sendpkt);
+  pkt_release(sendpkt);
 }
 
 /* the following routine will be called once (only) before any other */
@@ -259,6 +483,20 @@ void B_init(void)
   B_nextseqnum = 1;
 }
 
+/* write B's state to a checkpoint */
+void B_save(void)
+{
+  ckpt_write(&expectedseqnum, sizeof(expectedseqnum));
+  ckpt_write(&B_nextseqnum, sizeof(B_nextseqnum));
+}
+
+/* read back B's state saved by B_save() */
+void B_load(void)
+{
+  ckpt_read(&expectedseqnum, sizeof(expectedseqnum));
+  ckpt_read(&B_nextseqnum, sizeof(B_nextseqnum));
+}
+
 /******************************************************************************
  * The following functions need be completed only for bi-directional messages *
  *****************************************************************************/
@@ -5,7 +5,37 @@ extern void B_input(struct pkt);
 extern void A_output(struct msg);
 extern void A_timerinterrupt(void);
 
+/* pointer variants used by the emulator so that messages and packets are
+   not copied on every call */
+extern void A_input_ref(const struct pkt *);
+extern void B_input_ref(const struct pkt *);
+extern void A_output_ref(const struct msg *);
+
+/* called with a burst of messages from layer 5, which are sent back to back
+   for as long as the window allows */
+extern void A_outputv(const struct msg *, int);
+
+/* the number of messages A_outputv() would take now, for a source that
+   always has data ready */
+extern int A_windowspace(void);
+
+/* the sender's window in packets, read by A_init() and B_init(), and its
+   retransmission timeout.  Go-Back-N and Selective Repeat only */
+extern int windowsize;
+extern double rto;
+
+/* the largest window A_init() accepts */
+extern int A_maxwindow(void);
+
+/* save and restore the state of A and B for emulator checkpoints, which
+   name the protocol that wrote them */
+extern const char protocolname[];
+extern void A_save(void);
+extern void A_load(void);
+extern void B_save(void);
+extern void B_load(void);
+
 /* included for extension to bidirectional communication */
 #define BIDIRECTIONAL 0       /*  0 = A->B  1 =  A<->B */
 extern void B_output(struct msg);
-extern void B_timerinterrupt(void);
\ No newline at end of file
+extern void B_timerinterrupt(void);
@@ -0,0 +1,498 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include "emulator.h"
+#include "hybrid.h"
+
+
+#define true 1
+#define false 0
+
+/* ******************************************************************
+   Hybrid protocol: Go-Back-N while the loss rate is low, Selective
+   Repeat while it is high.
+
+   A estimates the loss rate from its own timers: each packet ACKed counts
+   as 0 and each timeout as 1 in an average with weight LOSSALPHA.  Above
+   HYBRIDHIGH it moves to Selective Repeat, below HYBRIDLOW back to
+   Go-Back-N.  The switch is made only with the window empty, when B has
+   delivered everything A sent: A takes no new messages until its window
+   drains, then tags the packets it sends with the new mode (in acknum,
+   which data packets do not use).  B follows when the packet at its
+   receive base carries the new mode, and tags each ACK with the mode it
+   was sent in (in seqnum), so A ignores late ACKs of the old mode.  Both
+   modes use Selective Repeat's sequence space of twice the window.
+*********************************************************************/
+
+#define RTT  16.0       /* round trip time.  MUST BE SET TO 16.0 when submitting assignment */
+#define WINDOWSIZE 6    /* the maximum number of buffered unacked packet */
+#define SEQSPACE 12     /* the sequence space must be twice the window size for SR */
+#define NOTINUSE (-1)   /* used to fill header fields that are not being used */
+
+#define GOBACKN   0     /* modes, carried in data packets and ACKs */
+#define SELECTIVE 1
+
+/* loss rates to switch at, with a gap between them so that A does not
+   switch back and forth while the rate hovers around one value */
+#ifndef HYBRIDHIGH
+#define HYBRIDHIGH 0.1
+#endif
+#ifndef HYBRIDLOW
+#define HYBRIDLOW 0.05
+#endif
+#define LOSSALPHA 0.05  /* weight of the newest sample in the loss estimate */
+
+const char protocolname[] = "hybrid";
+
+/* B's advertised window is only in gbn.c and sr.c.  Without it B would
+   take more than its application's buffer holds */
+#ifdef FLOWCONTROL
+#error "the hybrid protocol does not implement FLOWCONTROL"
+#endif
+
+/* its window and timeout are fixed at WINDOWSIZE and RTT, so the
+   emulator can neither set nor tune them */
+#ifdef SETWINDOW
+#error "the hybrid protocol does not implement SETWINDOW"
+#endif
+#ifdef TUNE
+#error "the hybrid protocol does not implement TUNE"
+#endif
+
+/* generic procedure to compute the checksum of a packet.  Used by both sender and receiver
+   the simulator will overwrite part of your packet with 'z's.  It will not overwrite your
+   original checksum.  This procedure must generate a different checksum to the original if
+   the packet is corrupted.
+*/
+int ComputeChecksum(const struct pkt *packet)
+{
+  int checksum = 0;
+  int i;
+
+  checksum = packet->seqnum;
+  checksum += packet->acknum;
+  for (i=0; i<PAYLOADSIZE; i++)
+    checksum += (int)(packet->payload[i]);
+
+  return checksum;
+}
+
+int IsCorrupted(const struct pkt *packet)
+{
+  if (packet->checksum == ComputeChecksum(packet))
+    return (0);
+  else
+    return (1);
+}
+
+/* returns true if seqnum lies in the window of WINDOWSIZE starting at base */
+static int InWindow(int base, int seqnum)
+{
+  return ((seqnum - base + SEQSPACE) % SEQSPACE) < WINDOWSIZE;
+}
+
+
+/********* Sender (A) variables and functions ************/
+
+/* SEQSPACE is a multiple of WINDOWSIZE, so a packet is stored at seqnum % WINDOWSIZE */
+static struct pkt *buffer[WINDOWSIZE];                  /* array for storing packets waiting for ACK */
+static int acked[WINDOWSIZE];                           /* true once the packet in buffer has been ACKed */
+static int windowfirst;                                 /* first sequence number in window */
+static int windowcount;                                 /* the number of packets in window not yet ACKed */
+static int A_nextseqnum;                                /* the next sequence number to be used by the sender */
+static int mode;                                        /* mode of the packets in the window */
+static int nextmode;                                    /* mode to switch to once the window is empty */
+static double lossrate;                                 /* estimated chance that a packet needs resending */
+
+/* add a sample to the loss estimate and pick the mode it calls for */
+static void SampleLoss(double lost)
+{
+  lossrate = (1.0 - LOSSALPHA) * lossrate + LOSSALPHA * lost;
+  if (lossrate > HYBRIDHIGH)
+    nextmode = SELECTIVE;
+  else if (lossrate < HYBRIDLOW)
+    nextmode = GOBACKN;
+}
+
+/* make a pending switch if the window is empty */
+static void SwitchMode(void)
+{
+  if (nextmode == mode || windowfirst != A_nextseqnum)
+    return;
+  if (TRACE > 0)
+    printf("----A: loss rate %f, switching to %s\n", lossrate,
+           nextmode == SELECTIVE ? "Selective Repeat" : "Go-Back-N");
+  mode = nextmode;
+}
+
+/* called from layer 5 (application layer), passed the message to be sent to other side */
+void A_output(struct msg message)
+{
+  A_output_ref(&message);
+}
+
+void A_output_ref(const struct msg *message)
+{
+  A_outputv(message, 1);
+}
+
+/* called from layer 5 with a burst of messages.  As many as fit in the
+   window are sent back to back, the rest are dropped.  While a switch is
+   pending the window is left to drain */
+void A_outputv(const struct msg *messages, int n)
+{
+  struct pkt *sendpkt;
+  int i, k;
+  int index;
+  int startbase;
+
+  SwitchMode();
+  startbase = (A_nextseqnum == windowfirst);
+
+  /* while the A_nextseqnum is inside the window */
+  for (k = 0; k < n && nextmode == mode && InWindow(windowfirst, A_nextseqnum); k++)
+  {
+    if (TRACE > 1)
+      printf("----A: New message arrives, send window is not full, send new messge to layer3!\n");
+
+    /* create packet, tagged with the mode */
+    sendpkt = pkt_alloc();
+    sendpkt->seqnum = A_nextseqnum;
+    sendpkt->acknum = mode;
+    for (i=0; i<PAYLOADSIZE; i++)
+      sendpkt->payload[i] = messages[k].data[i];
+    sendpkt->checksum = ComputeChecksum(sendpkt);
+
+    /* put packet in window buffer, which keeps the reference from pkt_alloc */
+    index = A_nextseqnum % WINDOWSIZE;
+    pkt_release(buffer[index]);
+    buffer[index] = sendpkt;
+    acked[index] = false;
+    windowcount++;
+
+    /* send packet */
+    if (TRACE > 0)
+      printf("Sending packet %d to layer 3\n", sendpkt->seqnum);
+    tolayer3_ref(A, sendpkt);
+
+    /* get next sequence number, wrap back to 0 */
+    A_nextseqnum = (A_nextseqnum + 1) % SEQSPACE;
+  }
+
+  /* start timer if first packet in window was sent */
+  if (startbase && k > 0)
+    starttimer(A, RTT);
+
+  /* if blocked, window is full */
+  for (; k < n; k++) {
+    if (TRACE > 0)
+      printf("----A: New message arrives, send window is full\n");
+    window_full++;
+  }
+}
+
+/* the number of messages that fit in the window now: none while it
+   drains for a switch */
+int A_windowspace(void)
+{
+  if (nextmode != mode && windowfirst != A_nextseqnum)
+    return 0;
+  return WINDOWSIZE - (A_nextseqnum - windowfirst + SEQSPACE) % SEQSPACE;
+}
+
+/* called from layer 3, when a packet arrives for layer 4 */
+void A_input(struct pkt packet)
+{
+  A_input_ref(&packet);
+}
+
+void A_input_ref(const struct pkt *packet)
+{
+  int index;
+  int ackcount, i;
+
+  /* if received ACK is not corrupted */
+  if (IsCorrupted(packet)) {
+    if (TRACE > 0)
+      printf("----A: corrupted ACK is received, do nothing!\n");
+    return;
+  }
+  if (TRACE > 0)
+    printf("----A: uncorrupted ACK %d is received\n",packet->acknum);
+  total_ACKs_received++;
+
+  /* it must be for a packet sent but not yet slid out of the window, and
+     in the mode of the window */
+  if (packet->seqnum != mode || windowcount == 0 || packet->acknum < 0 || packet->acknum >= SEQSPACE ||
+      ((packet->acknum - windowfirst + SEQSPACE) % SEQSPACE) >=
+      ((A_nextseqnum - windowfirst + SEQSPACE) % SEQSPACE)) {
+    if (TRACE > 0)
+      printf("----A: duplicate ACK received, do nothing!\n");
+    return;
+  }
+
+  if (mode == GOBACKN) {
+    /* cumulative acknowledgement of the packets up to acknum */
+    if (TRACE > 0)
+      printf("----A: ACK %d is not a duplicate\n",packet->acknum);
+    new_ACKs++;
+    ackcount = (packet->acknum - windowfirst + SEQSPACE) % SEQSPACE + 1;
+    for (i = 0; i < ackcount; i++) {
+      pkt_release(buffer[windowfirst % WINDOWSIZE]);
+      buffer[windowfirst % WINDOWSIZE] = NULL;
+      windowfirst = (windowfirst + 1) % SEQSPACE;
+      SampleLoss(0.0);
+    }
+    windowcount -= ackcount;
+  }
+  else {
+    index = packet->acknum % WINDOWSIZE;
+    if (acked[index]) {
+      if (TRACE > 0)
+        printf("----A: duplicate ACK received, do nothing!\n");
+      return;
+    }
+    if (TRACE > 0)
+      printf("----A: ACK %d is not a duplicate\n",packet->acknum);
+    new_ACKs++;
+    windowcount--;
+    acked[index] = true;
+    SampleLoss(0.0);
+    if (packet->acknum != windowfirst)
+      return;
+
+    /* slide window past all consecutive ACKed packets */
+    while (windowfirst != A_nextseqnum && acked[windowfirst % WINDOWSIZE]) {
+      pkt_release(buffer[windowfirst % WINDOWSIZE]);
+      buffer[windowfirst % WINDOWSIZE] = NULL;
+      windowfirst = (windowfirst + 1) % SEQSPACE;
+    }
+  }
+
+  /* restart timer, or switch if the window has drained */
+  stoptimer(A);
+  if (windowcount > 0)
+    starttimer(A, RTT);
+  else
+    SwitchMode();
+}
+
+/* called when A's timer goes off */
+void A_timerinterrupt(void)
+{
+  int i, seq;
+
+  if (TRACE > 0)
+    printf("----A: time out,resend packets!\n");
+  SampleLoss(1.0);
+
+  /* Go-Back-N resends the whole window, Selective Repeat its first packet */
+  for (i = 0; i < (mode == GOBACKN ? windowcount : 1); i++) {
+    seq = (windowfirst + i) % SEQSPACE;
+    if (TRACE > 0)
+      printf ("---A: resending packet %d\n", seq);
+    tolayer3_ref(A, buffer[seq % WINDOWSIZE]);
+    packets_resent++;
+  }
+  starttimer(A, RTT);
+}
+
+/* the following routine will be called once (only) before any other */
+/* entity A routines are called. You can use it to do any initialization */
+void A_init(void)
+{
+  int i;
+
+  /* drop any packets still held from a previous run */
+  for (i = 0; i < WINDOWSIZE; i++) {
+    pkt_release(buffer[i]);
+    buffer[i] = NULL;
+    acked[i] = false;
+  }
+
+  /* initialise A's window, buffer and sequence number */
+  A_nextseqnum = 0;  /* A starts with seq num 0, do not change this */
+  windowfirst = 0;
+  windowcount = 0;
+  mode = nextmode = GOBACKN;
+  lossrate = 0.0;
+}
+
+/* write A's state to a checkpoint */
+void A_save(void)
+{
+  int i;
+
+  ckpt_write(&A_nextseqnum, sizeof(A_nextseqnum));
+  ckpt_write(&windowfirst, sizeof(windowfirst));
+  ckpt_write(&windowcount, sizeof(windowcount));
+  ckpt_write(acked, sizeof(acked));
+  ckpt_write(&mode, sizeof(mode));
+  ckpt_write(&nextmode, sizeof(nextmode));
+  ckpt_write(&lossrate, sizeof(lossrate));
+  for (i = 0; i < WINDOWSIZE; i++)
+    ckpt_writepkt(buffer[i]);
+}
+
+/* read back A's state saved by A_save() */
+void A_load(void)
+{
+  int i;
+
+  ckpt_read(&A_nextseqnum, sizeof(A_nextseqnum));
+  ckpt_read(&windowfirst, sizeof(windowfirst));
+  ckpt_read(&windowcount, sizeof(windowcount));
+  ckpt_read(acked, sizeof(acked));
+  ckpt_read(&mode, sizeof(mode));
+  ckpt_read(&nextmode, sizeof(nextmode));
+  ckpt_read(&lossrate, sizeof(lossrate));
+  for (i = 0; i < WINDOWSIZE; i++) {
+    pkt_release(buffer[i]);
+    buffer[i] = ckpt_readpkt();
+  }
+}
+
+/********* Receiver (B)  variables and procedures ************/
+
+static const struct pkt *rcv_buffer[WINDOWSIZE]; /* packets received ahead of rcv_base, stored at seqnum % WINDOWSIZE */
+static int rcv_base;                         /* first sequence number in receiving window */
+static int B_mode;                           /* mode B is receiving in */
+
+/* send an ACK for seqnum, tagged with B's mode */
+static void SendACK(int seqnum)
+{
+  struct pkt *sendpkt;
+  int i;
+
+  sendpkt = pkt_alloc();
+  sendpkt->acknum = seqnum;
+  sendpkt->seqnum = B_mode;
+  for (i=0; i<PAYLOADSIZE; i++)
+    sendpkt->payload[i] = '0';
+  sendpkt->checksum = ComputeChecksum(sendpkt);
+  tolayer3_ref(B, sendpkt);
+  pkt_release(sendpkt);
+}
+
+/* deliver the run of consecutive packets starting at the base */
+static void DeliverRun(void)
+{
+  int index;
+
+  while (rcv_buffer[rcv_base % WINDOWSIZE] != NULL) {
+    index = rcv_base % WINDOWSIZE;
+    tolayer5(B, rcv_buffer[index]->payload);
+    pkt_release(rcv_buffer[index]);
+    rcv_buffer[index] = NULL;
+    rcv_base = (rcv_base + 1) % SEQSPACE;
+  }
+}
+
+/* called from layer 3, when a packet arrives for layer 4 at B*/
+void B_input(struct pkt packet)
+{
+  struct pkt *p;
+
+  /* B may hold on to the packet, so it needs a buffer of its own */
+  p = pkt_alloc();
+  *p = packet;
+  B_input_ref(p);
+  pkt_release(p);
+}
+
+void B_input_ref(const struct pkt *packet)
+{
+  int index;
+  int corrupt = IsCorrupted(packet);
+
+  /* A has drained its window and switched: everything before rcv_base is
+     delivered, so B switches with it */
+  if (!corrupt && packet->seqnum == rcv_base && packet->acknum != B_mode &&
+      (packet->acknum == GOBACKN || packet->acknum == SELECTIVE)) {
+    if (TRACE > 0)
+      printf("----B: packet %d switches to %s\n", packet->seqnum,
+             packet->acknum == SELECTIVE ? "Selective Repeat" : "Go-Back-N");
+    B_mode = packet->acknum;
+  }
+
+  if (B_mode == GOBACKN) {
+    /* deliver in order packets, and answer anything with the last one */
+    if (!corrupt && packet->seqnum == rcv_base) {
+      if (TRACE > 0)
+        printf("----B: packet %d is correctly received, send ACK!\n",packet->seqnum);
+      packets_received++;
+      index = packet->seqnum % WINDOWSIZE;
+      if (rcv_buffer[index] == NULL)   /* else held since Selective Repeat */
+        rcv_buffer[index] = pkt_hold(packet);
+      DeliverRun();
+    }
+    else if (TRACE > 0)
+      printf("----B: packet corrupted or not expected sequence number, resend ACK!\n");
+    SendACK((rcv_base + SEQSPACE - 1) % SEQSPACE);
+  }
+  else if (!corrupt) {
+    if (TRACE > 0)
+      printf("----B: packet %d is correctly received, send ACK!\n",packet->seqnum);
+    packets_received++;
+    SendACK(packet->seqnum);
+
+    /* if in window and not a duplicate, keep a reference to it */
+    index = packet->seqnum % WINDOWSIZE;
+    if (packet->seqnum >= 0 && packet->seqnum < SEQSPACE &&
+        InWindow(rcv_base, packet->seqnum) && rcv_buffer[index] == NULL) {
+      rcv_buffer[index] = pkt_hold(packet);
+      DeliverRun();
+    }
+  }
+}
+
+/* the following routine will be called once (only) before any other */
+/* entity B routines are called. You can use it to do any initialization */
+void B_init(void)
+{
+  int i;
+
+  for (i = 0; i < WINDOWSIZE; i++) {
+    pkt_release(rcv_buffer[i]);
+    rcv_buffer[i] = NULL;
+  }
+  rcv_base = 0;
+  B_mode = GOBACKN;
+}
+
+/* write B's state to a checkpoint */
+void B_save(void)
+{
+  int i;
+
+  ckpt_write(&rcv_base, sizeof(rcv_base));
+  ckpt_write(&B_mode, sizeof(B_mode));
+  for (i = 0; i < WINDOWSIZE; i++)
+    ckpt_writepkt(rcv_buffer[i]);
+}
+
+/* read back B's state saved by B_save() */
+void B_load(void)
+{
+  int i;
+
+  ckpt_read(&rcv_base, sizeof(rcv_base));
+  ckpt_read(&B_mode, sizeof(B_mode));
+  for (i = 0; i < WINDOWSIZE; i++) {
+    pkt_release(rcv_buffer[i]);
+    rcv_buffer[i] = ckpt_readpkt();
+  }
+}
+
+/******************************************************************************
+ * The following functions need be completed only for bi-directional messages *
+ *****************************************************************************/
+
+/* Note that with simplex transfer from a-to-B, there is no B_output() */
+void B_output(struct msg message)
+{
+}
+
+/* called when B's timer goes off */
+void B_timerinterrupt(void)
+{
+}
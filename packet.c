@@ -0,0 +1,139 @@
+/* ******************************************************************
+   Packet buffers shared by the emulator back ends (emulator.c and the
+   real time back ends).
+
+   A packet handed out by pkt_alloc() carries a reference count, so the
+   sender's window, the network and the receiver can all refer to the one
+   copy of a packet while it is in flight.  Buffers are recycled through a
+   free list instead of going back to malloc.
+
+   Also here are the routines that write and read checkpoint files, so
+   that the protocols can save their state whichever back end they are
+   linked with.
+**********************************************************************/
+#include <stdlib.h>
+#include <stdio.h>
+#include <stddef.h>
+#include "emulator.h"
+
+struct pktbuf {
+  int refcount;
+  struct pktbuf *next;     /* link in the free list when not in use */
+  struct pkt pkt;
+};
+
+#define PKTBUF(p) ((struct pktbuf *)((const char *)(p) - offsetof(struct pktbuf, pkt)))
+
+/* in the parallel build a packet can be released by a different thread
+   from the one holding it, so the count is updated atomically and each
+   thread recycles buffers through its own free list */
+#ifdef PARALLEL
+#define THREADLOCAL __thread
+#define ADDREF(b, n) __atomic_add_fetch(&(b)->refcount, (n), __ATOMIC_ACQ_REL)
+#else
+#define THREADLOCAL
+#define ADDREF(b, n) ((b)->refcount += (n))
+#endif
+
+static THREADLOCAL struct pktbuf *pktfree = NULL;   /* recycled packet buffers */
+
+struct pkt *pkt_alloc(void)
+{
+  struct pktbuf *b;
+
+  if (pktfree != NULL) {
+    b = pktfree;
+    pktfree = b->next;
+  }
+  else {
+    b = malloc(sizeof(struct pktbuf));
+    if (b == 0) {
+      printf("memory allocation for packet failed.");
+      exit(EXIT_FAILURE);
+    }
+  }
+  b->refcount = 1;
+  b->next = NULL;
+  return &b->pkt;
+}
+
+const struct pkt *pkt_hold(const struct pkt *p)
+{
+  ADDREF(PKTBUF(p), 1);
+  return p;
+}
+
+void pkt_release(const struct pkt *p)
+{
+  struct pktbuf *b;
+
+  if (p == NULL)
+    return;
+  b = PKTBUF(p);
+  if (ADDREF(b, -1) == 0) {
+    b->next = pktfree;
+    pktfree = b;
+  }
+}
+
+/********************** CHECKPOINT FILES ***********************/
+
+static FILE *ckptfile = NULL;     /* checkpoint being written or read */
+
+void ckpt_open(const char *name, int writing)
+{
+  ckptfile = fopen(name, writing ? "wb" : "rb");
+  if (ckptfile == NULL) {
+    printf("unable to open checkpoint file %s\n", name);
+    exit(EXIT_FAILURE);
+  }
+}
+
+void ckpt_close(void)
+{
+  if (ckptfile != NULL && fclose(ckptfile) != 0) {
+    printf("error writing checkpoint file\n");
+    exit(EXIT_FAILURE);
+  }
+  ckptfile = NULL;
+}
+
+void ckpt_write(const void *p, int n)
+{
+  if (fwrite(p, 1, n, ckptfile) != (size_t)n) {
+    printf("error writing checkpoint file\n");
+    exit(EXIT_FAILURE);
+  }
+}
+
+void ckpt_read(void *p, int n)
+{
+  if (fread(p, 1, n, ckptfile) != (size_t)n) {
+    printf("checkpoint file is truncated\n");
+    exit(EXIT_FAILURE);
+  }
+}
+
+/* packets are written by value, so buffers that were shared when the
+   checkpoint was taken are separate copies once it is read back */
+void ckpt_writepkt(const struct pkt *p)
+{
+  int present = (p != NULL);
+
+  ckpt_write(&present, sizeof(present));
+  if (present)
+    ckpt_write(p, sizeof(struct pkt));
+}
+
+struct pkt *ckpt_readpkt(void)
+{
+  struct pkt *p;
+  int present;
+
+  ckpt_read(&present, sizeof(present));
+  if (!present)
+    return NULL;
+  p = pkt_alloc();
+  ckpt_read(p, sizeof(struct pkt));
+  return p;
+}
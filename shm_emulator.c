@@ -0,0 +1,500 @@
+/* ******************************************************************
+   SHARED MEMORY BACK END
+
+   Runs the unmodified protocol code (gbn.c, sr.c or hybrid.c) with A and
+   B in two processes that exchange packets through shared memory, to
+   measure what the protocol code itself costs without the emulator's
+   event list or the kernel's sockets.  It implements the same
+   student-callable routines:
+   - tolayer3() writes the packet into a single-producer single-consumer
+     ring in memory shared with the other process.  Loss and corruption
+     are injected here, by the writer.
+   - starttimer()/stoptimer() set and clear a deadline on the monotonic
+     clock, which the entity's loop checks.  One time unit of the
+     protocol is a configurable number of microseconds.
+   - tolayer5() counts delivered messages.
+
+   Each process polls its ring, its timer and (at A) the arrivals from
+   layer 5 in a loop.  With two or more processors online, A and B are
+   pinned to processors of their own and spin while there is nothing to
+   do, giving the processor up only after a while.  On one processor
+   they give it up at once, as spinning only delays the other.
+   Messages from layer 5 arrive uniformly on [0,2*lambda] time units
+   apart, as in emulator.c, or with lambda 0 whenever A's window has room.
+   At the end the packet rate and the cycles (the time where there is no
+   TSC) spent in the protocol code per packet are reported, less the time
+   spent in the routines above.
+
+   build: gcc -O2 -o gbn_shm shm_emulator.c packet.c gbn.c -lm
+   ********************************************************************* */
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <limits.h>
+#include <unistd.h>
+#include <time.h>
+#include <sched.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <sys/resource.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define HAVE_TSC 1
+#endif
+#include "emulator.h"
+#include "gbn.h"
+
+#define RINGSIZE  4096      /* packets in each ring, a power of 2 */
+#define CACHELINE 64
+#define SPINS     1000      /* idle polls before giving up the processor */
+#define IDLETIME  2.0       /* seconds without a delivery before giving up */
+
+int TRACE = 0;
+
+/* statistics updated by GBN */
+int window_full;   /* count of the number of messages dropped due to full window */
+int total_ACKs_received;
+int packets_resent;       /* count of the number of packets resent  */
+int fast_retransmits;     /* count of the packets resent on duplicate ACKs */
+int window_probes;        /* count of the packets sent into a closed receive window */
+int new_ACKs;           /* count of the number of acks correctly received */
+int packets_received;  /* count of the packets received by receiver */
+
+/* a ring of packets written by one process and read by the other.  The
+   writer owns head and the reader owns tail, on cache lines of their own */
+struct ring {
+  uint32_t head;                  /* next slot to write */
+  char pad1[CACHELINE - sizeof(uint32_t)];
+  uint32_t tail;                  /* next slot to read */
+  char pad2[CACHELINE - sizeof(uint32_t)];
+  struct pkt slot[RINGSIZE];
+};
+
+/* the shared memory.  B's statistics are copied here when it stops */
+static struct shared {
+  struct ring ring[2];            /* to A and to B */
+  int done;                       /* A has seen everything delivered */
+  int messages_delivered;         /* at B, kept up to date */
+  int packets_received;
+  long ntolayer3, nlost, ncorrupt, nfull;
+  long nreceived;
+  uint64_t protocoltime;
+} *shm;
+
+/* statistics updated by the back end, for the process's own entity */
+static long   ntolayer3;          /* number sent into layer 3 */
+static long   nlost;              /* number lost by loss injection */
+static long   ncorrupt;           /* number corrupted by corruption injection */
+static long   nfull;              /* number lost to a full ring */
+static long   nreceived;          /* packets read from the ring */
+static uint64_t protocoltime;     /* cycles (or ns) spent in the protocol code */
+
+static int    nsim = 0;           /* number of messages from 5 to 4 so far */
+static int    nsimmax = 0;        /* number of msgs to generate, then stop */
+static float  lossprob;           /* probability that a packet is dropped  */
+static float  corruptprob;        /* probability that one bit is packet is flipped */
+static int    corruptdirection;   /* A->B A<-B or bidirectional corruption/loss */
+static float  lambda;             /* arrival rate of messages from layer 5 */
+static double timeunit;           /* length of one time unit in microseconds */
+
+static int    me;                 /* the entity this process runs */
+static int    spins;              /* idle polls before giving up the processor */
+static double deadline;           /* of its timer */
+static int    timerrunning;
+static uint32_t cachedtail;       /* the reader's tail when the writer last looked */
+static uint32_t cachedhead;       /* the writer's head when the reader last looked */
+
+/* the random number generator, as in emulator.c */
+double jimsrand(void)
+{
+  double mmm = RAND_MAX;
+  double x;
+  x = rand()/mmm;            /* x should be uniform in [0,1] */
+  return(x);
+}
+
+static double now(clockid_t clock)
+{
+  struct timespec ts;
+
+  clock_gettime(clock, &ts);
+  return ts.tv_sec + ts.tv_nsec/1e9;
+}
+
+void init(void)
+{
+  printf("-----  Shared Memory Two Process Network Version 1.0 -------- \n\n");
+  printf("Enter the number of messages to simulate: ");
+  scanf("%d",&nsimmax);
+  printf("Enter  packet loss probability [enter 0.0 for no loss]:");
+  scanf("%f",&lossprob);
+  printf("Enter packet corruption probability [0.0 for no corruption]:");
+  scanf("%f",&corruptprob);
+  if (lossprob != 0.0 || corruptprob != 0.0) {
+    printf("If you want loss or corruption to only occur in one direction, choose the direction: 0 A->B, 1 A<-B, 2 A<->B (both directions) :");
+    scanf("%d",&corruptdirection);
+  }
+  printf("Enter average time between messages from sender's layer5 [0.0 whenever the window has room]:");
+  scanf("%f",&lambda);
+  printf("Enter the length of a time unit in microseconds [ > 0.0]:");
+  scanf("%lf",&timeunit);
+  printf("Enter TRACE:");
+  scanf("%d",&TRACE);
+
+  shm = mmap(NULL, sizeof(*shm), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+  if (shm == MAP_FAILED) {
+    perror("mmap");
+    exit(EXIT_FAILURE);
+  }
+  memset(shm, 0, sizeof(*shm));
+
+  window_full = 0;
+  total_ACKs_received = 0;
+  packets_resent = 0;
+  fast_retransmits = 0;
+  window_probes = 0;
+  new_ACKs = 0;
+  packets_received = 0;
+}
+
+/* cycles of the TSC where there is one, or else nanoseconds */
+static uint64_t ticks(void)
+{
+#ifdef HAVE_TSC
+  return __rdtsc();
+#else
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec*1000000000ull + ts.tv_nsec;
+#endif
+}
+
+/* time the protocol code.  The student-callable routines below are only
+   called from inside it, and leave the time they take themselves out */
+static uint64_t t0;
+
+static void enter(void)
+{
+  t0 = ticks();
+}
+
+static void leave(void)
+{
+  protocoltime += ticks() - t0;
+}
+
+/********************** Student-callable ROUTINES ***********************/
+
+void stoptimer(int AorB)
+{
+  (void)AorB;                   /* each process has the timer of its own entity only */
+  if (TRACE>1)
+    printf("          STOP TIMER: stopping timer\n");
+  if (!timerrunning) {
+    printf("Warning: unable to cancel your timer. It wasn't running.\n");
+    return;
+  }
+  timerrunning = 0;
+}
+
+void starttimer(int AorB, double increment)
+{
+  (void)AorB;
+  if (TRACE>1)
+    printf("          START TIMER: starting timer\n");
+  if (timerrunning) {
+    printf("Warning: attempt to start a timer that is already started\n");
+    return;
+  }
+  leave();
+  deadline = now(CLOCK_MONOTONIC) + increment*timeunit/1e6;
+  enter();
+  timerrunning = 1;
+}
+
+/* write a packet into the other process's ring, unless it is lost */
+static void transmit(int AorB, const struct pkt *packet)
+{
+  struct ring *r = &shm->ring[(AorB+1) % 2];
+  struct pkt *p;
+  int inscope = !(AorB == B && corruptdirection == A) && !(AorB == A && corruptdirection == B);
+  uint32_t head = r->head;       /* only this process writes it */
+  double x;
+  int i;
+
+  ntolayer3++;
+
+  /* simulate losses: */
+  if (jimsrand() < lossprob && inscope) {
+    nlost++;
+    if (TRACE>0)
+      printf("          TOLAYER3: packet being lost\n");
+    return;
+  }
+
+  /* look at the reader's tail only when the ring seems full */
+  if (head - cachedtail == RINGSIZE) {
+    cachedtail = __atomic_load_n(&r->tail, __ATOMIC_ACQUIRE);
+    if (head - cachedtail == RINGSIZE) {
+      nfull++;                  /* lost, as on a real link */
+      return;
+    }
+  }
+  p = &r->slot[head % RINGSIZE];
+  *p = *packet;
+
+  /* simulate corruption: */
+  if (jimsrand() < corruptprob && inscope) {
+    ncorrupt++;
+    if ( (x = jimsrand()) < .75)
+      p->payload[0]='Z';   /* corrupt payload */
+    else if (x < .875)
+      p->seqnum = 999999;
+    else
+      p->acknum = 999999;
+    if (TRACE>0)
+      printf("          TOLAYER3: packet being corrupted\n");
+  }
+  if (TRACE>2)  {
+    printf("          TOLAYER3: seq: %d, ack %d, check: %d ", p->seqnum, p->acknum, p->checksum);
+    for (i=0; i<PAYLOADSIZE; i++)
+      printf("%c",p->payload[i]);
+    printf("\n");
+  }
+  __atomic_store_n(&r->head, head + 1, __ATOMIC_RELEASE);
+}
+
+void tolayer3_ref(int AorB, const struct pkt *packet)
+{
+  leave();
+  transmit(AorB, packet);
+  enter();
+}
+
+void tolayer3(int AorB, struct pkt packet)
+{
+  tolayer3_ref(AorB, &packet);
+}
+
+void tolayer5(int AorB, const char datasent[PAYLOADSIZE])
+{
+  int i;
+  if (TRACE>2) {
+    printf("          TOLAYER5: data received by application at %c: ", AorB == A ? 'A' : 'B');
+    for (i=0; i<PAYLOADSIZE; i++)
+      printf("%c",datasent[i]);
+    printf("\n");
+  }
+  __atomic_store_n(&shm->messages_delivered, shm->messages_delivered + 1, __ATOMIC_RELEASE);
+}
+
+/* the application reads each message as it is delivered */
+int rcvroom(int AorB)
+{
+  (void)AorB;
+  return INT_MAX;
+}
+
+/* hand the protocol the packets waiting in the ring.  Returns how many */
+static int receive(void)
+{
+  struct ring *r = &shm->ring[me];
+  uint32_t tail = r->tail;       /* only this process writes it */
+  struct pkt *p;
+  int n = 0;
+
+  if (tail == cachedhead) {
+    cachedhead = __atomic_load_n(&r->head, __ATOMIC_ACQUIRE);
+    if (tail == cachedhead)
+      return 0;
+  }
+  while (tail != cachedhead) {
+    /* a copy the protocol may keep, as the slot will be written again */
+    p = pkt_alloc();
+    *p = r->slot[tail % RINGSIZE];
+    tail++;
+    __atomic_store_n(&r->tail, tail, __ATOMIC_RELEASE);
+    nreceived++;
+    enter();
+    if (me == A)
+      A_input_ref(p);
+    else
+      B_input_ref(p);
+    leave();
+    pkt_release(p);
+    n++;
+  }
+  return n;
+}
+
+/* give layer 4 the next message */
+static void arrival(void)
+{
+  struct msg msg2give;
+  int i, j;
+
+  j = nsim % 26;
+  for (i=0; i<PAYLOADSIZE; i++)
+    msg2give.data[i] = 97 + j;
+  nsim++;
+  enter();
+  A_output_ref(&msg2give);
+  leave();
+}
+
+/* the timer of this process has gone off if its deadline has passed */
+static int timeout(double t)
+{
+  if (!timerrunning || t < deadline)
+    return 0;
+  timerrunning = 0;
+  enter();
+  if (me == A)
+    A_timerinterrupt();
+  else
+    B_timerinterrupt();
+  leave();
+  return 1;
+}
+
+/* run this process on a processor of its own, if there are enough */
+static void pin(void)
+{
+  cpu_set_t set;
+
+  if (sysconf(_SC_NPROCESSORS_ONLN) < 2) {
+    spins = 0;
+    return;
+  }
+  spins = SPINS;
+  CPU_ZERO(&set);
+  CPU_SET(me, &set);
+  if (sched_setaffinity(0, sizeof(set), &set) < 0)
+    perror("sched_setaffinity");    /* still works, just less evenly */
+}
+
+/* A's loop: run until every message it accepted has been delivered */
+static void runA(void)
+{
+  double t, nextarrival, lastprogress;
+  int idle = 0, work, delivered, lastdelivered = 0;
+
+  t = lastprogress = now(CLOCK_MONOTONIC);
+  nextarrival = t + lambda*jimsrand()*2*timeunit/1e6;
+  while (1) {
+    delivered = __atomic_load_n(&shm->messages_delivered, __ATOMIC_ACQUIRE);
+    if (nsim == nsimmax && delivered >= nsim - window_full)
+      break;
+    t = now(CLOCK_MONOTONIC);
+    work = receive() + timeout(t);
+    if (lambda > 0.0)
+      for (; nsim < nsimmax && t >= nextarrival; work++) {
+        arrival();
+        nextarrival += lambda*jimsrand()*2*timeunit/1e6;
+      }
+    else
+      for (; nsim < nsimmax && A_windowspace() > 0; work++)
+        arrival();
+
+    if (delivered != lastdelivered) {
+      lastdelivered = delivered;
+      lastprogress = t;
+    }
+    else if (t - lastprogress > IDLETIME) {
+      printf("Warning: nothing delivered for %.0f s, giving up\n", IDLETIME);
+      break;
+    }
+    if (work > 0)
+      idle = 0;
+    else if (++idle > spins)
+      sched_yield();
+  }
+  __atomic_store_n(&shm->done, 1, __ATOMIC_RELEASE);
+}
+
+/* B's loop: run until A is done */
+static void runB(void)
+{
+  int idle = 0;
+
+  while (!__atomic_load_n(&shm->done, __ATOMIC_ACQUIRE)) {
+    if (receive() + timeout(now(CLOCK_MONOTONIC)) > 0)
+      idle = 0;
+    else if (++idle > spins)
+      sched_yield();
+  }
+  shm->packets_received = packets_received;
+  shm->ntolayer3 = ntolayer3;
+  shm->nlost = nlost;
+  shm->ncorrupt = ncorrupt;
+  shm->nfull = nfull;
+  shm->nreceived = nreceived;
+  shm->protocoltime = protocoltime;
+}
+
+int main(void)
+{
+  struct rusage ru, ruchild;
+  double start, elapsed, cpu;
+  long packets;
+  pid_t child;
+
+  init();
+  A_init();
+  B_init();
+
+  fflush(stdout);             /* or the child prints it again */
+  start = now(CLOCK_MONOTONIC);
+  child = fork();
+  if (child < 0) {
+    perror("fork");
+    exit(EXIT_FAILURE);
+  }
+  if (child == 0) {
+    me = B;
+    pin();
+    srand(19999);           /* a stream of its own, as in the parallel emulator */
+    runB();
+    exit(EXIT_SUCCESS);
+  }
+  me = A;
+  pin();
+  srand(9999);              /* init random number generator */
+  runA();
+  if (waitpid(child, NULL, 0) < 0) {
+    perror("waitpid");
+    exit(EXIT_FAILURE);
+  }
+  elapsed = now(CLOCK_MONOTONIC) - start;
+  getrusage(RUSAGE_SELF, &ru);
+  getrusage(RUSAGE_CHILDREN, &ruchild);
+  cpu = ru.ru_utime.tv_sec + ru.ru_utime.tv_usec/1e6 + ru.ru_stime.tv_sec + ru.ru_stime.tv_usec/1e6
+      + ruchild.ru_utime.tv_sec + ruchild.ru_utime.tv_usec/1e6 + ruchild.ru_stime.tv_sec + ruchild.ru_stime.tv_usec/1e6;
+  packets = nreceived + shm->nreceived;
+
+  printf(" Run ended after %f seconds\n after attempting to send %d msgs from layer5\n", elapsed, nsim);
+  printf("number of messages dropped due to full window:  %d \n", window_full);
+  printf("number of valid (not corrupt or duplicate) acknowledgements received at A:  %d \n", new_ACKs);
+  printf("number of packet resends by A:  %d \n", packets_resent);
+  if (fast_retransmits > 0)
+    printf("number of packets fast retransmitted by A:  %d \n", fast_retransmits);
+  if (window_probes > 0)
+    printf("number of zero window probes sent by A:  %d \n", window_probes);
+  printf("number of correct packets received at B:  %d \n", shm->packets_received);
+  printf("number of messages delivered to application:  %d \n", shm->messages_delivered);
+  printf("packets sent into layer 3:  %ld (lost %ld, corrupted %ld, refused by a full ring %ld)\n",
+         ntolayer3 + shm->ntolayer3, nlost + shm->nlost, ncorrupt + shm->ncorrupt, nfull + shm->nfull);
+  printf("packets read from the rings:  %ld by A, %ld by B\n", nreceived, shm->nreceived);
+  printf("packet rate:  %.3f Mpps\n", elapsed > 0 ? packets/elapsed/1e6 : 0.0);
+  printf("CPU time:  %f s for both processes, %.3f us per packet\n", cpu, packets > 0 ? cpu*1e6/packets : 0.0);
+#ifdef HAVE_TSC
+  printf("protocol code:  %.0f TSC cycles per packet\n",
+#else
+  printf("protocol code:  %.0f ns per packet\n",
+#endif
+         packets > 0 ? (double)(protocoltime + shm->protocoltime)/packets : 0.0);
+  return EXIT_SUCCESS;
+}
@@ -1,5 +1,6 @@
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
 #include "emulator.h"
 #include "gbn.h"
 
@@ -12,159 +13,295 @@
 *********************************************************************/
 
 #define RTT  16.0       /* round trip time.  MUST BE SET TO 16.0 when submitting assignment */
-#define WINDOWSIZE 6    /* the maximum number of buffered unacked packet */
-#define SEQSPACE 12     /* the sequence space must be twice the window size for SR */
+#ifndef WINDOWSIZE
+#define WINDOWSIZE 6    /* default maximum number of buffered unacked packet */
+#endif
+#define MAXWINDOW 64    /* the largest window, the size of the buffers below */
+#define SEQSPACE (2*windowsize)  /* the sequence space must be twice the window size for SR */
 #define NOTINUSE (-1)   /* used to fill header fields that are not being used */
 
+/* the maximum number of buffered unacked packets and the timeout.  Can
+   be changed before A_init() and B_init() are called, the window up to
+   MAXWINDOW */
+int windowsize = WINDOWSIZE;
+double rto = RTT;
+
+const char protocolname[] = "sr";
+
+/* with -DNAK, B answers a packet that arrives ahead of a gap with a NAK
+   as well as the ACK.  A NAK has seqnum NAKSEQ, acknum B's rcv_base and
+   payload[j] == '1' if rcv_base + j is missing, '2' for the packet that
+   showed up the gap.  A resends the missing packets at once instead of
+   waiting for its timer, unless it has resent one since it sent the
+   packet that showed up the gap.  B does not name a hole again until
+   NAKHOLDOFF more packets have arrived, by when the resent copy should
+   have filled it */
+#ifndef NAK
+#define NAK 0
+#endif
+#define NAKSEQ (-2)
+#define NAKHOLDOFF windowsize
+
+/* with -DFLOWCONTROL, every ACK carries B's rcv_base and the number of
+   packets from there that it has room for (rcvroom(), at most the
+   window) in its payload, and A sends no further.  Packets A holds back
+   wait in its window; when all it has sent is ACKed and the window is
+   still closed, its timer sends the next one anyway as a probe.  B drops
+   a packet beyond its room and answers with an ACK for the packet
+   before rcv_base, which only updates A's window */
+#ifndef FLOWCONTROL
+#define FLOWCONTROL 0
+#endif
+#if FLOWCONTROL && PAYLOADSIZE < 8
+#error "flow control carries the receive window in the ACK payload"
+#endif
+
 /* generic procedure to compute the checksum of a packet.  Used by both sender and receiver  
    the simulator will overwrite part of your packet with 'z's.  It will not overwrite your 
    original checksum.  This procedure must generate a different checksum to the original if
    the packet is corrupted.
 */
-int ComputeChecksum(struct pkt packet)
+int ComputeChecksum(const struct pkt *packet)
 {
   int checksum = 0;
   int i;
 
-  checksum = packet.seqnum;
-  checksum += packet.acknum;
-  for ( i=0; i<20; i++ ) 
-    checksum += (int)(packet.payload[i]);
+  checksum = packet->seqnum;
+  checksum += packet->acknum;
+  for (i=0; i<PAYLOADSIZE; i++)
+    checksum += (int)(packet->payload[i]);
 
   return checksum;
 }
 
-int IsCorrupted(struct pkt packet)
+int IsCorrupted(const struct pkt *packet)
 {
-  if (packet.checksum == ComputeChecksum(packet))
+  if (packet->checksum == ComputeChecksum(packet))
     return (0);
   else
     return (1);
 }
 
+/* returns true if seqnum lies in the window of windowsize starting at base */
+static int InWindow(int base, int seqnum)
+{
+  return ((seqnum - base + SEQSPACE) % SEQSPACE) < windowsize;
+}
+
 
 /********* Sender (A) variables and functions ************/
 
-static struct pkt buffer[WINDOWSIZE];                   /* array for storing packets waiting for ACK */
+/* SEQSPACE is a multiple of windowsize, so a packet is stored at seqnum % windowsize */
+static struct pkt *buffer[MAXWINDOW];                   /* array for storing packets waiting for ACK */
+static int acked[MAXWINDOW];                            /* true once the packet in buffer has been ACKed */
 static int windowfirst;                                 /* first sequence number in window */
 static int windowcount;                                 /* the number of packets currently in window */
 static int A_nextseqnum;                                /* the next sequence number to be used by the sender */
+static int A_nextsend;                                  /* the first packet in the window not sent yet */
+static int rwndbase, rwnd;                              /* B's rcv_base and room from its last ACK */
+static unsigned int sentat[MAXWINDOW];                  /* value of nsent when the packet was last sent */
+static unsigned int nsent;                              /* packets sent by A so far */
+
+/* send packet seqnum from the window buffer, noting when */
+static void SendBuffered(int seqnum)
+{
+  sentat[seqnum % windowsize] = ++nsent;
+  tolayer3_ref(A, buffer[seqnum % windowsize]);
+}
 
 /* called from layer 5 (application layer), passed the message to be sent to other side */
 void A_output(struct msg message)
 {
-  struct pkt sendpkt;
-  int i;
+  A_output_ref(&message);
+}
+
+void A_output_ref(const struct msg *message)
+{
+  A_outputv(message, 1);
+}
+
+/* send the packets of the window B has room for.  Returns true if the
+   first of them was sent, when nothing else was awaiting an ACK */
+static int SendWindow(void)
+{
+  int wasidle = (A_nextsend == windowfirst);
+  int sent = false;
+
+  while (A_nextsend != A_nextseqnum &&
+         (!FLOWCONTROL || (A_nextsend - rwndbase + SEQSPACE) % SEQSPACE < rwnd)) {
+    if (TRACE > 0)
+      printf("Sending packet %d to layer 3\n", A_nextsend);
+    SendBuffered(A_nextsend);
+    A_nextsend = (A_nextsend + 1) % SEQSPACE;
+    sent = true;
+  }
+  return wasidle && sent;
+}
+
+/* called from layer 5 with a burst of messages.  As many as fit in the
+   window are sent back to back, the rest are dropped */
+void A_outputv(const struct msg *messages, int n)
+{
+  struct pkt *sendpkt;
+  int i, k;
   int index;
-  int seqfirst = windowfirst;
-  int seqlast = (windowfirst + WINDOWSIZE - 1) % SEQSPACE;
+  int startbase = (A_nextseqnum == windowfirst);
 
-  /* if the A_nextseqnum is inside the window */
-  if (((seqfirst <= seqlast) && (A_nextseqnum >= seqfirst && A_nextseqnum <= seqlast)) ||
-      ((seqfirst > seqlast) && (A_nextseqnum >= seqfirst || A_nextseqnum <= seqlast)))
+  /* while the A_nextseqnum is inside the window */
+  for (k = 0; k < n && InWindow(windowfirst, A_nextseqnum); k++)
   {
     if (TRACE > 1)
       printf("----A: New message arrives, send window is not full, send new messge to layer3!\n");
 
     /* create packet */
-    sendpkt.seqnum = A_nextseqnum;
-    sendpkt.acknum = NOTINUSE;
-    for (i=0; i<20; i++)
-      sendpkt.payload[i] = message.data[i];
-    sendpkt.checksum = ComputeChecksum(sendpkt);
-
-    /* put packet in window buffer */
-    if (A_nextseqnum >= seqfirst)
-      index = A_nextseqnum - seqfirst;
-    else
-      index = WINDOWSIZE - seqfirst + A_nextseqnum;
+    sendpkt = pkt_alloc();
+    sendpkt->seqnum = A_nextseqnum;
+    sendpkt->acknum = NOTINUSE;
+    for (i=0; i<PAYLOADSIZE; i++)
+      sendpkt->payload[i] = messages[k].data[i];
+    sendpkt->checksum = ComputeChecksum(sendpkt);
+
+    /* put packet in window buffer, which keeps the reference from pkt_alloc */
+    index = A_nextseqnum % windowsize;
+    pkt_release(buffer[index]);
     buffer[index] = sendpkt;
+    acked[index] = false;
     windowcount++;
 
-    /* send packet */
-    if (TRACE > 0)
-      printf("Sending packet %d to layer 3\n", sendpkt.seqnum);
-    tolayer3(A, sendpkt);
-
-    /* start timer if first packet in window */
-    if (A_nextseqnum == seqfirst)
-      starttimer(A, RTT);
-
     /* get next sequence number, wrap back to 0 */
     A_nextseqnum = (A_nextseqnum + 1) % SEQSPACE;
+
+    /* send packet, if B has room for it */
+    SendWindow();
   }
+
+  /* start timer if first packet in window was sent */
+  if (startbase && k > 0)
+    starttimer(A, rto);
+
   /* if blocked, window is full */
-  else {
+  for (; k < n; k++) {
     if (TRACE > 0)
       printf("----A: New message arrives, send window is full\n");
     window_full++;
   }
 }
 
+/* the number of messages that fit in the window now: the sequence
+   numbers from A_nextseqnum to the end of the window */
+int A_windowspace(void)
+{
+  return windowsize - (A_nextseqnum - windowfirst + SEQSPACE) % SEQSPACE;
+}
+
+/* the largest window A_init() accepts: the size of the buffers, and with
+   NAK one payload byte for each packet in the window */
+int A_maxwindow(void)
+{
+  if (NAK && PAYLOADSIZE < MAXWINDOW)
+    return PAYLOADSIZE;
+  return MAXWINDOW;
+}
+
 /* called from layer 3, when a packet arrives for layer 4 */
 void A_input(struct pkt packet)
 {
-  int ackcount = 0;
-  int i;
-  int seqfirst = windowfirst;
-  int seqlast = (windowfirst + WINDOWSIZE - 1) % SEQSPACE;
+  A_input_ref(&packet);
+}
+
+void A_input_ref(const struct pkt *packet)
+{
   int index;
+  int i, seq, trigger = -1;
+  int base, room;
+
+  /* a NAK: resend the missing packets A still holds */
+  if (NAK && !IsCorrupted(packet) && packet->seqnum == NAKSEQ) {
+    if (TRACE > 0)
+      printf("----A: NAK from base %d is received\n", packet->acknum);
+    if (packet->acknum < 0 || packet->acknum >= SEQSPACE)
+      return;
+    for (i = 0; i < windowsize; i++)
+      if (packet->payload[i] == '2')
+        trigger = (packet->acknum + i) % SEQSPACE;
+    for (i = 0; i < windowsize; i++) {
+      seq = (packet->acknum + i) % SEQSPACE;
+      if (packet->payload[i] != '1' || trigger < 0 ||
+          ((seq - windowfirst + SEQSPACE) % SEQSPACE) >= ((A_nextsend - windowfirst + SEQSPACE) % SEQSPACE) ||
+          acked[seq % windowsize] || (int)(sentat[seq % windowsize] - sentat[trigger % windowsize]) > 0)
+        continue;
+      if (TRACE > 0)
+        printf("---A: resending packet %d\n", seq);
+      SendBuffered(seq);
+      fast_retransmits++;
+      if (seq == windowfirst) {   /* the timer was for this copy */
+        stoptimer(A);
+        starttimer(A, rto);
+      }
+    }
+    return;
+  }
 
   /* if received ACK is not corrupted */ 
   if (!IsCorrupted(packet)) {
     if (TRACE > 0)
-      printf("----A: uncorrupted ACK %d is received\n",packet.acknum);
+      printf("----A: uncorrupted ACK %d is received\n",packet->acknum);
     total_ACKs_received++;
 
-    /* check if new ACK */
-    if (windowcount != 0) {
-      /* check case when seqnum has and hasn't wrapped */
-      if (((seqfirst <= seqlast) && (packet.acknum >= seqfirst && packet.acknum <= seqlast)) ||
-          ((seqfirst > seqlast) && (packet.acknum >= seqfirst || packet.acknum <= seqlast)))
-      {
-        /* check corresponding position in window buffer */
-        if (packet.acknum >= seqfirst)
-          index = packet.acknum - seqfirst;
-        else
-          index = WINDOWSIZE - seqfirst + packet.acknum;
-
-        if (buffer[index].acknum == NOTINUSE) {
-          /* packet is a new ACK */
-          if (TRACE > 0)
-            printf("----A: ACK %d is not a duplicate\n",packet.acknum);
-          new_ACKs++;
-          windowcount--;
-          buffer[index].acknum = packet.acknum;
-
-          /* if it's the base packet */
-          if (packet.acknum == seqfirst) {
-            /* check how many consecutive acks received in buffer */
-            for (i = 0; i < WINDOWSIZE; i++) {
-              if (buffer[i].acknum != NOTINUSE && buffer[i].payload[0] != '\0')
-                ackcount++;
-              else
-                break;
-            }
-
-            /* slide window */
-            windowfirst = (windowfirst + ackcount) % SEQSPACE;
-
-            /* update buffer */
-            for (i = 0; i < WINDOWSIZE; i++) {
-              if (i + ackcount < WINDOWSIZE)
-                buffer[i] = buffer[i + ackcount];
-            }
-
-            /* restart timer */
-            stoptimer(A);
-            if (windowcount > 0)
-              starttimer(A, RTT);
+    /* B's receive window.  ACKs can be overtaken by later ones, as on
+       different paths, so an older rcv_base is ignored.  rcv_base moves
+       at most a window either way, and with the same rcv_base B's room
+       only grows, so the larger room is the later one */
+    if (FLOWCONTROL) {
+      memcpy(&base, packet->payload, sizeof(base));
+      memcpy(&room, packet->payload + sizeof(base), sizeof(room));
+      if (base == rwndbase) {
+        if (room > rwnd)
+          rwnd = room;
+      }
+      else if ((base - rwndbase + SEQSPACE) % SEQSPACE <= windowsize) {
+        rwndbase = base;
+        rwnd = room;
+      }
+      if (windowcount != 0 && SendWindow()) {
+        stoptimer(A);               /* the timer was for a probe */
+        starttimer(A, rto);
+      }
+    }
+
+    /* check if new ACK: it must be for a packet sent but not yet slid out of the window */
+    if (windowcount != 0 && packet->acknum >= 0 && packet->acknum < SEQSPACE &&
+        ((packet->acknum - windowfirst + SEQSPACE) % SEQSPACE) <
+        ((A_nextsend - windowfirst + SEQSPACE) % SEQSPACE))
+    {
+      index = packet->acknum % windowsize;
+
+      if (!acked[index]) {
+        /* packet is a new ACK */
+        if (TRACE > 0)
+          printf("----A: ACK %d is not a duplicate\n",packet->acknum);
+        new_ACKs++;
+        windowcount--;
+        acked[index] = true;
+
+        /* if it's the base packet */
+        if (packet->acknum == windowfirst) {
+          /* slide window past all consecutive ACKed packets */
+          while (windowfirst != A_nextseqnum && acked[windowfirst % windowsize]) {
+            pkt_release(buffer[windowfirst % windowsize]);
+            buffer[windowfirst % windowsize] = NULL;
+            windowfirst = (windowfirst + 1) % SEQSPACE;
           }
+
+          /* restart timer */
+          stoptimer(A);
+          if (windowcount > 0)
+            starttimer(A, rto);
         }
-        else {
-          if (TRACE > 0)
-            printf("----A: duplicate ACK received, do nothing!\n");
-        }
+      }
+      else {
+        if (TRACE > 0)
+          printf("----A: duplicate ACK received, do nothing!\n");
       }
     }
   }
@@ -177,93 +314,215 @@ void A_input(struct pkt packet)
 /* called when A's timer goes off */
 void A_timerinterrupt(void)
 {
+  /* nothing sent is outstanding, the window B advertised is closed */
+  if (A_nextsend == windowfirst) {
+    if (TRACE > 0)
+      printf("----A: time out with the receive window closed, send probe %d!\n", A_nextsend);
+    SendBuffered(A_nextsend);
+    A_nextsend = (A_nextsend + 1) % SEQSPACE;
+    window_probes++;
+    starttimer(A, rto);
+    return;
+  }
+
   if (TRACE > 0) {
     printf("----A: time out,resend packets!\n");
-    printf("---A: resending packet %d\n", buffer[0].seqnum);
+    printf("---A: resending packet %d\n", buffer[windowfirst % windowsize]->seqnum);
   }
-  tolayer3(A, buffer[0]);
+  SendBuffered(windowfirst);
   packets_resent++;
-  starttimer(A, RTT);
+  starttimer(A, rto);
 }
 
 /* the following routine will be called once (only) before any other */
 /* entity A routines are called. You can use it to do any initialization */
 void A_init(void)
 {
+  int i;
+
+  /* drop any packets still held from a previous run */
+  for (i = 0; i < MAXWINDOW; i++) {
+    pkt_release(buffer[i]);
+    buffer[i] = NULL;
+    acked[i] = false;
+    sentat[i] = 0;
+  }
+
+  if (windowsize < 1 || windowsize > MAXWINDOW) {
+    printf("window size must be between 1 and %d\n", MAXWINDOW);
+    exit(EXIT_FAILURE);
+  }
+  if (NAK && windowsize > PAYLOADSIZE) {
+    printf("a NAK needs a payload byte for each packet in the window\n");
+    exit(EXIT_FAILURE);
+  }
+
   /* initialise A's window, buffer and sequence number */
   A_nextseqnum = 0;  /* A starts with seq num 0, do not change this */
+  A_nextsend = 0;
   windowfirst = 0;
   windowcount = 0;
+  nsent = 0;
+
+  /* until B says otherwise, assume it has room for one packet */
+  rwndbase = 0;
+  rwnd = 1;
+}
+
+/* write A's state to a checkpoint */
+void A_save(void)
+{
+  int i;
+
+  ckpt_write(&windowsize, sizeof(windowsize));
+  ckpt_write(&A_nextseqnum, sizeof(A_nextseqnum));
+  ckpt_write(&A_nextsend, sizeof(A_nextsend));
+  ckpt_write(&rwndbase, sizeof(rwndbase));
+  ckpt_write(&rwnd, sizeof(rwnd));
+  ckpt_write(&windowfirst, sizeof(windowfirst));
+  ckpt_write(&windowcount, sizeof(windowcount));
+  ckpt_write(acked, sizeof(acked));
+  ckpt_write(sentat, sizeof(sentat));
+  ckpt_write(&nsent, sizeof(nsent));
+  for (i = 0; i < windowsize; i++)
+    ckpt_writepkt(buffer[i]);
+}
+
+/* read back A's state saved by A_save() */
+void A_load(void)
+{
+  int i;
+
+  /* the window the checkpoint was taken with, checked by A_init() */
+  ckpt_read(&windowsize, sizeof(windowsize));
+  A_init();
+  ckpt_read(&A_nextseqnum, sizeof(A_nextseqnum));
+  ckpt_read(&A_nextsend, sizeof(A_nextsend));
+  ckpt_read(&rwndbase, sizeof(rwndbase));
+  ckpt_read(&rwnd, sizeof(rwnd));
+  ckpt_read(&windowfirst, sizeof(windowfirst));
+  ckpt_read(&windowcount, sizeof(windowcount));
+  ckpt_read(acked, sizeof(acked));
+  ckpt_read(sentat, sizeof(sentat));
+  ckpt_read(&nsent, sizeof(nsent));
+  for (i = 0; i < windowsize; i++) {
+    pkt_release(buffer[i]);
+    buffer[i] = ckpt_readpkt();
+  }
 }
 
 /********* Receiver (B)  variables and procedures ************/
 
-static struct pkt rcv_buffer[WINDOWSIZE];    /* array for storing packets waiting for packet from A */
+static const struct pkt *rcv_buffer[MAXWINDOW];  /* packets received ahead of rcv_base, stored at seqnum % windowsize */
 static int rcv_base;                         /* first sequence number in receiving window */
-static int rcv_last;                         /* last received packet position */
+static int nakage[MAXWINDOW];                /* packets received since the hole was NAKed, -1 if not yet */
+
+/* send a NAK for the holes before seqnum that have not been NAKed lately */
+static void SendNAK(int seqnum)
+{
+  struct pkt *sendpkt;
+  int i, index, named = 0;
+
+  sendpkt = pkt_alloc();
+  sendpkt->seqnum = NAKSEQ;
+  sendpkt->acknum = rcv_base;
+  for (i = 0; i < PAYLOADSIZE; i++)
+    sendpkt->payload[i] = '0';
+  for (i = 0; (rcv_base + i) % SEQSPACE != seqnum; i++) {
+    index = (rcv_base + i) % windowsize;
+    if (rcv_buffer[index] != NULL)
+      continue;
+    if (nakage[index] < 0 || nakage[index] >= NAKHOLDOFF) {
+      sendpkt->payload[i] = '1';
+      nakage[index] = 0;
+      named++;
+    }
+    else
+      nakage[index]++;
+  }
+  sendpkt->payload[i] = '2';
+  sendpkt->checksum = ComputeChecksum(sendpkt);
+  if (named > 0) {
+    if (TRACE > 0)
+      printf("----B: %d packets missing before %d, send NAK!\n", named, seqnum);
+    tolayer3_ref(B, sendpkt);
+  }
+  pkt_release(sendpkt);
+}
 
 /* called from layer 3, when a packet arrives for layer 4 at B*/
 void B_input(struct pkt packet)
 {
-  struct pkt sendpkt;
-  int i;
-  int pckcount = 0;
-  int seqfirst = rcv_base;
-  int seqlast = (rcv_base + WINDOWSIZE - 1) % SEQSPACE;
+  struct pkt *p;
+
+  /* B may hold on to the packet, so it needs a buffer of its own */
+  p = pkt_alloc();
+  *p = packet;
+  B_input_ref(p);
+  pkt_release(p);
+}
+
+void B_input_ref(const struct pkt *packet)
+{
+  struct pkt *sendpkt;
+  int i, room;
   int index;
+  int acknum = packet->seqnum;
+  int nak = false;
 
   if (!IsCorrupted(packet)) {
-    if (TRACE > 0)
-      printf("----B: packet %d is correctly received, send ACK!\n",packet.seqnum);
     packets_received++;
 
-    /* create ACK packet */
-    sendpkt.acknum = packet.seqnum;
-    sendpkt.seqnum = NOTINUSE;
-    for (i=0; i<20; i++)
-      sendpkt.payload[i] = '0';
-    sendpkt.checksum = ComputeChecksum(sendpkt);
-    tolayer3(B, sendpkt);
-
     /* check if packet is in window */
-    if (((seqfirst <= seqlast) && (packet.seqnum >= seqfirst && packet.seqnum <= seqlast)) ||
-        ((seqfirst > seqlast) && (packet.seqnum >= seqfirst || packet.seqnum <= seqlast)))
+    if (InWindow(rcv_base, packet->seqnum))
     {
-      /* get index in buffer */
-      if (packet.seqnum >= seqfirst)
-        index = packet.seqnum - seqfirst;
-      else
-        index = WINDOWSIZE - seqfirst + packet.seqnum;
-
-      /* update rcv_last */
-      rcv_last = rcv_last > index ? rcv_last : index;
-
-      /* if not duplicate, save to buffer */
-      if (rcv_buffer[index].payload[0] == '\0') {
-        rcv_buffer[index] = packet;
-
-        /* if it's the base packet */
-        if (packet.seqnum == seqfirst) {
-          /* count consecutive received packets */
-          for (i = 0; i < WINDOWSIZE; i++) {
-            if (rcv_buffer[i].payload[0] != '\0')
-              pckcount++;
-            else
-              break;
-          }
-
-          /* update base and buffer */
-          rcv_base = (rcv_base + pckcount) % SEQSPACE;
-          for (i = 0; i < WINDOWSIZE; i++) {
-            if (i + pckcount < WINDOWSIZE)
-              rcv_buffer[i] = rcv_buffer[i + pckcount];
-          }
+      index = packet->seqnum % windowsize;
+
+      /* beyond the room B has: drop it, and ACK the packet before
+         rcv_base so that A only learns the window */
+      if (FLOWCONTROL && (packet->seqnum - rcv_base + SEQSPACE) % SEQSPACE >= rcvroom(B)) {
+        if (TRACE > 0)
+          printf("----B: packet %d is beyond the receive window, drop it!\n", packet->seqnum);
+        acknum = (rcv_base + SEQSPACE - 1) % SEQSPACE;
+      }
+      /* if not duplicate, keep a reference to it in the buffer */
+      else if (rcv_buffer[index] == NULL) {
+        rcv_buffer[index] = pkt_hold(packet);
+        nakage[index] = -1;
+        nak = (NAK && packet->seqnum != rcv_base);
+
+        /* deliver the run of consecutive packets starting at the base */
+        while (rcv_buffer[rcv_base % windowsize] != NULL) {
+          index = rcv_base % windowsize;
+          tolayer5(B, rcv_buffer[index]->payload);
+          pkt_release(rcv_buffer[index]);
+          rcv_buffer[index] = NULL;
+          rcv_base = (rcv_base + 1) % SEQSPACE;
         }
-
-        /* deliver to application */
-        tolayer5(B, packet.payload);
       }
     }
+
+    if (TRACE > 0)
+      printf("----B: packet %d is correctly received, send ACK!\n",packet->seqnum);
+
+    /* create ACK packet, after delivery so that it carries the room left */
+    sendpkt = pkt_alloc();
+    sendpkt->acknum = acknum;
+    sendpkt->seqnum = NOTINUSE;
+    for (i=0; i<PAYLOADSIZE; i++)
+      sendpkt->payload[i] = '0';
+    if (FLOWCONTROL) {
+      room = rcvroom(B) < windowsize ? rcvroom(B) : windowsize;
+      memcpy(sendpkt->payload, &rcv_base, sizeof(rcv_base));
+      memcpy(sendpkt->payload + sizeof(rcv_base), &room, sizeof(room));
+    }
+    sendpkt->checksum = ComputeChecksum(sendpkt);
+    tolayer3_ref(B, sendpkt);
+    pkt_release(sendpkt);
+
+    /* the NAK follows the ACK for the packet that showed the holes */
+    if (nak)
+      SendNAK(packet->seqnum);
   }
 }
 
@@ -271,8 +530,38 @@ void B_input(struct pkt packet)
 /* entity B routines are called. You can use it to do any initialization */
 void B_init(void)
 {
+  int i;
+
+  for (i = 0; i < MAXWINDOW; i++) {
+    pkt_release(rcv_buffer[i]);
+    rcv_buffer[i] = NULL;
+    nakage[i] = -1;
+  }
   rcv_base = 0;
-  rcv_last = -1;
+}
+
+/* write B's state to a checkpoint */
+void B_save(void)
+{
+  int i;
+
+  ckpt_write(&rcv_base, sizeof(rcv_base));
+  ckpt_write(nakage, sizeof(nakage));
+  for (i = 0; i < windowsize; i++)
+    ckpt_writepkt(rcv_buffer[i]);
+}
+
+/* read back B's state saved by B_save() */
+void B_load(void)
+{
+  int i;
+
+  ckpt_read(&rcv_base, sizeof(rcv_base));
+  ckpt_read(nakage, sizeof(nakage));
+  for (i = 0; i < windowsize; i++) {
+    pkt_release(rcv_buffer[i]);
+    rcv_buffer[i] = ckpt_readpkt();
+  }
 }
 
 /******************************************************************************
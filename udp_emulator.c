@@ -0,0 +1,483 @@
+/* ******************************************************************
+   REAL TIME UDP BACK END
+
+   Runs the unmodified protocol code (gbn.c or sr.c) against real UDP
+   sockets on the loopback interface instead of the simulated network in
+   emulator.c.  It implements the same student-callable routines:
+   - tolayer3() sends the packet as a datagram from the sending entity's
+     socket to the other entity's socket.  Loss and corruption are
+     injected here, before the packet reaches the socket.
+   - starttimer()/stoptimer() arm and disarm a timerfd on the monotonic
+     clock.  One time unit of the protocol is a configurable number of
+     microseconds.
+   - tolayer5() counts delivered messages.
+
+   Entities A and B share one epoll loop.  Datagrams are read with
+   recvmmsg() and the packets the protocols send in response are queued
+   and written with sendmmsg() once the batch has been handled, so the
+   system call cost is spread over many packets.
+
+   Messages from layer 5 arrive uniformly on [0,2*lambda] time units
+   apart, as in emulator.c.  At the end the packet rate and CPU time per
+   packet are reported.
+
+   build: gcc -o gbn_udp udp_emulator.c packet.c gbn.c -lm
+   ********************************************************************* */
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <limits.h>
+#include <errno.h>
+#include <unistd.h>
+#include <time.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+#include <sys/resource.h>
+#include "emulator.h"
+#include "gbn.h"
+
+#define BATCH     64        /* datagrams per sendmmsg/recvmmsg call */
+#define IDLETIME  2000      /* ms without events before giving up */
+
+/* epoll tags */
+#define SOCKET_A  0
+#define SOCKET_B  1
+#define TIMER_A   2
+#define TIMER_B   3
+#define LAYER5    4
+
+int TRACE = 0;
+
+/* statistics updated by GBN */
+int window_full;   /* count of the number of messages dropped due to full window */
+int total_ACKs_received;
+int packets_resent;       /* count of the number of packets resent  */
+int fast_retransmits;     /* count of the packets resent on duplicate ACKs */
+int window_probes;        /* count of the packets sent into a closed receive window */
+int new_ACKs;           /* count of the number of acks correctly received */
+int packets_received;  /* count of the packets received by receiver */
+
+/* statistics updated by the back end */
+static long   ntolayer3;          /* number sent into layer 3 */
+static long   nlost;              /* number lost by loss injection */
+static long   ncorrupt;           /* number corrupted by corruption injection */
+static long   nsenderr;           /* number the socket refused to send */
+static long   nreceived;          /* datagrams read from the sockets */
+static long   nsendcalls, nrecvcalls;
+static int    messages_delivered;
+
+static int    nsim = 0;           /* number of messages from 5 to 4 so far */
+static int    nsimmax = 0;        /* number of msgs to generate, then stop */
+static float  lossprob;           /* probability that a packet is dropped  */
+static float  corruptprob;        /* probability that one bit is packet is flipped */
+static int    corruptdirection;   /* A->B A<-B or bidirectional corruption/loss */
+static float  lambda;             /* arrival rate of messages from layer 5 */
+static double timeunit;           /* length of one time unit in microseconds */
+
+static int epfd;
+static int sock[2];               /* UDP socket of A and B */
+static struct sockaddr_in addr[2];/* address each socket is bound to */
+static int timerfd[2];            /* retransmission timer of A and B */
+static int timerrunning[2];
+static int arrivalfd;             /* timer for the next message from layer 5 */
+
+/* datagrams waiting to be sent by each entity */
+static struct pkt     outpkt[2][BATCH];
+static struct iovec   outiov[2][BATCH];
+static struct mmsghdr outmsg[2][BATCH];
+static int            noutq[2];
+
+/* the random number generator, as in emulator.c */
+double jimsrand(void)
+{
+  double mmm = RAND_MAX;
+  double x;
+  x = rand()/mmm;            /* x should be uniform in [0,1] */
+  return(x);
+}
+
+/* arm a timerfd to go off once after the given number of time units */
+static void armtimer(int fd, double units)
+{
+  struct itimerspec its;
+  double us = units*timeunit;
+
+  memset(&its, 0, sizeof(its));
+  if (us < 1.0)
+    us = 1.0;          /* an all zero it_value would disarm the timer */
+  its.it_value.tv_sec = (time_t)(us/1e6);
+  its.it_value.tv_nsec = (long)((us - its.it_value.tv_sec*1e6)*1e3);
+  if (timerfd_settime(fd, 0, &its, NULL) < 0) {
+    perror("timerfd_settime");
+    exit(EXIT_FAILURE);
+  }
+}
+
+static void disarmtimer(int fd)
+{
+  struct itimerspec its;
+
+  memset(&its, 0, sizeof(its));
+  timerfd_settime(fd, 0, &its, NULL);
+}
+
+/* read a timerfd, returning the number of expirations since the last read */
+static uint64_t readtimer(int fd)
+{
+  uint64_t n;
+
+  if (read(fd, &n, sizeof(n)) != sizeof(n))
+    return 0;
+  return n;
+}
+
+static void watch(int fd, int tag)
+{
+  struct epoll_event ev;
+
+  memset(&ev, 0, sizeof(ev));
+  ev.events = EPOLLIN;
+  ev.data.u32 = tag;
+  if (epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &ev) < 0) {
+    perror("epoll_ctl");
+    exit(EXIT_FAILURE);
+  }
+}
+
+static void opensocket(int AorB)
+{
+  socklen_t len = sizeof(addr[AorB]);
+  int size = 4*1024*1024;
+
+  sock[AorB] = socket(AF_INET, SOCK_DGRAM | SOCK_NONBLOCK, 0);
+  if (sock[AorB] < 0) {
+    perror("socket");
+    exit(EXIT_FAILURE);
+  }
+  setsockopt(sock[AorB], SOL_SOCKET, SO_RCVBUF, &size, sizeof(size));
+  setsockopt(sock[AorB], SOL_SOCKET, SO_SNDBUF, &size, sizeof(size));
+  memset(&addr[AorB], 0, sizeof(addr[AorB]));
+  addr[AorB].sin_family = AF_INET;
+  addr[AorB].sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  addr[AorB].sin_port = 0;   /* let the kernel pick a port */
+  if (bind(sock[AorB], (struct sockaddr *)&addr[AorB], sizeof(addr[AorB])) < 0 ||
+      getsockname(sock[AorB], (struct sockaddr *)&addr[AorB], &len) < 0) {
+    perror("bind");
+    exit(EXIT_FAILURE);
+  }
+}
+
+void init(void)
+{
+  int i;
+
+  printf("-----  Real Time UDP Loopback Network Version 1.0 -------- \n\n");
+  printf("Enter the number of messages to simulate: ");
+  scanf("%d",&nsimmax);
+  printf("Enter  packet loss probability [enter 0.0 for no loss]:");
+  scanf("%f",&lossprob);
+  printf("Enter packet corruption probability [0.0 for no corruption]:");
+  scanf("%f",&corruptprob);
+  if (lossprob != 0.0 || corruptprob != 0.0) {
+    printf("If you want loss or corruption to only occur in one direction, choose the direction: 0 A->B, 1 A<-B, 2 A<->B (both directions) :");
+    scanf("%d",&corruptdirection);
+  }
+  printf("Enter average time between messages from sender's layer5 [ > 0.0]:");
+  scanf("%f",&lambda);
+  printf("Enter the length of a time unit in microseconds [ > 0.0]:");
+  scanf("%lf",&timeunit);
+  printf("Enter TRACE:");
+  scanf("%d",&TRACE);
+
+  srand(9999);              /* init random number generator */
+
+  epfd = epoll_create1(0);
+  if (epfd < 0) {
+    perror("epoll_create1");
+    exit(EXIT_FAILURE);
+  }
+  for (i=A; i<=B; i++) {
+    opensocket(i);
+    timerfd[i] = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK);
+    if (timerfd[i] < 0) {
+      perror("timerfd_create");
+      exit(EXIT_FAILURE);
+    }
+    timerrunning[i] = 0;
+    noutq[i] = 0;
+  }
+  arrivalfd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK);
+  if (arrivalfd < 0) {
+    perror("timerfd_create");
+    exit(EXIT_FAILURE);
+  }
+  watch(sock[A], SOCKET_A);
+  watch(sock[B], SOCKET_B);
+  watch(timerfd[A], TIMER_A);
+  watch(timerfd[B], TIMER_B);
+  watch(arrivalfd, LAYER5);
+
+  window_full = 0;
+  total_ACKs_received = 0;
+  packets_resent = 0;
+  fast_retransmits = 0;
+  window_probes = 0;
+  new_ACKs = 0;
+  packets_received = 0;
+  messages_delivered = 0;
+}
+
+/********************** Student-callable ROUTINES ***********************/
+
+void stoptimer(int AorB)
+{
+  if (TRACE>1)
+    printf("          STOP TIMER: stopping timer\n");
+  if (!timerrunning[AorB]) {
+    printf("Warning: unable to cancel your timer. It wasn't running.\n");
+    return;
+  }
+  disarmtimer(timerfd[AorB]);
+  readtimer(timerfd[AorB]);   /* discard an expiry not yet handled */
+  timerrunning[AorB] = 0;
+}
+
+void starttimer(int AorB, double increment)
+{
+  if (TRACE>1)
+    printf("          START TIMER: starting timer\n");
+  if (timerrunning[AorB]) {
+    printf("Warning: attempt to start a timer that is already started\n");
+    return;
+  }
+  armtimer(timerfd[AorB], increment);
+  timerrunning[AorB] = 1;
+}
+
+/* send everything queued by AorB in as few system calls as possible */
+static void flush(int AorB)
+{
+  int sent = 0;
+  int n;
+
+  while (sent < noutq[AorB]) {
+    n = sendmmsg(sock[AorB], &outmsg[AorB][sent], noutq[AorB] - sent, 0);
+    nsendcalls++;
+    if (n < 0) {
+      if (errno == EINTR)
+        continue;
+      /* socket buffer full: the rest are lost, as they would be on a real link */
+      nsenderr += noutq[AorB] - sent;
+      break;
+    }
+    sent += n;
+  }
+  noutq[AorB] = 0;
+}
+
+void tolayer3_ref(int AorB, const struct pkt *packet)
+{
+  struct pkt *p;
+  int inscope = !(AorB == B && corruptdirection == A) && !(AorB == A && corruptdirection == B);
+  double x;
+  int i;
+
+  ntolayer3++;
+
+  /* simulate losses: */
+  if (jimsrand() < lossprob && inscope) {
+    nlost++;
+    if (TRACE>0)
+      printf("          TOLAYER3: packet being lost\n");
+    return;
+  }
+
+  if (noutq[AorB] == BATCH)
+    flush(AorB);
+  p = &outpkt[AorB][noutq[AorB]];
+  *p = *packet;     /* the datagram has to be assembled somewhere anyway */
+
+  /* simulate corruption: */
+  if (jimsrand() < corruptprob && inscope) {
+    ncorrupt++;
+    if ( (x = jimsrand()) < .75)
+      p->payload[0]='Z';   /* corrupt payload */
+    else if (x < .875)
+      p->seqnum = 999999;
+    else
+      p->acknum = 999999;
+    if (TRACE>0)
+      printf("          TOLAYER3: packet being corrupted\n");
+  }
+  if (TRACE>2)  {
+    printf("          TOLAYER3: seq: %d, ack %d, check: %d ", p->seqnum, p->acknum, p->checksum);
+    for (i=0; i<PAYLOADSIZE; i++)
+      printf("%c",p->payload[i]);
+    printf("\n");
+  }
+
+  outiov[AorB][noutq[AorB]].iov_base = p;
+  outiov[AorB][noutq[AorB]].iov_len = sizeof(struct pkt);
+  memset(&outmsg[AorB][noutq[AorB]], 0, sizeof(struct mmsghdr));
+  outmsg[AorB][noutq[AorB]].msg_hdr.msg_iov = &outiov[AorB][noutq[AorB]];
+  outmsg[AorB][noutq[AorB]].msg_hdr.msg_iovlen = 1;
+  outmsg[AorB][noutq[AorB]].msg_hdr.msg_name = &addr[(AorB+1) % 2];
+  outmsg[AorB][noutq[AorB]].msg_hdr.msg_namelen = sizeof(struct sockaddr_in);
+  noutq[AorB]++;
+}
+
+void tolayer3(int AorB, struct pkt packet)
+{
+  tolayer3_ref(AorB, &packet);
+}
+
+void tolayer5(int AorB, const char datasent[PAYLOADSIZE])
+{
+  int i;
+  if (TRACE>2) {
+    printf("          TOLAYER5: data received by application at %c: ", AorB == A ? 'A' : 'B');
+    for (i=0; i<PAYLOADSIZE; i++)
+      printf("%c",datasent[i]);
+    printf("\n");
+  }
+  messages_delivered++;
+}
+
+/* the application reads each message as it is delivered */
+int rcvroom(int AorB)
+{
+  (void)AorB;
+  return INT_MAX;
+}
+
+/* read a batch of datagrams arriving at AorB and hand them to the protocol */
+static void receive(int AorB)
+{
+  static struct mmsghdr msgs[BATCH];
+  static struct iovec iov[BATCH];
+  struct pkt *p[BATCH];
+  int i, n;
+
+  for (i=0; i<BATCH; i++) {
+    p[i] = pkt_alloc();
+    iov[i].iov_base = p[i];
+    iov[i].iov_len = sizeof(struct pkt);
+    memset(&msgs[i], 0, sizeof(struct mmsghdr));
+    msgs[i].msg_hdr.msg_iov = &iov[i];
+    msgs[i].msg_hdr.msg_iovlen = 1;
+  }
+  n = recvmmsg(sock[AorB], msgs, BATCH, 0, NULL);
+  nrecvcalls++;
+  for (i=0; i<n; i++) {
+    if (msgs[i].msg_len != sizeof(struct pkt))
+      continue;
+    nreceived++;
+    if (AorB == A)
+      A_input_ref(p[i]);
+    else
+      B_input_ref(p[i]);
+  }
+  for (i=0; i<BATCH; i++)
+    pkt_release(p[i]);
+}
+
+/* hand layer 4 the messages that have arrived since the last expiry */
+static void arrivals(void)
+{
+  struct msg msg2give;
+  uint64_t n;
+  int i, j;
+
+  for (n = readtimer(arrivalfd); n > 0 && nsim < nsimmax; n--) {
+    j = nsim % 26;
+    for (i=0; i<PAYLOADSIZE; i++)
+      msg2give.data[i] = 97 + j;
+    nsim++;
+    A_output_ref(&msg2give);
+  }
+  if (nsim < nsimmax)
+    armtimer(arrivalfd, lambda*jimsrand()*2);
+}
+
+static double now(clockid_t clock)
+{
+  struct timespec ts;
+
+  clock_gettime(clock, &ts);
+  return ts.tv_sec + ts.tv_nsec/1e9;
+}
+
+int main(void)
+{
+  struct epoll_event events[8];
+  struct rusage ru;
+  double start, elapsed, cpu;
+  int i, n;
+
+  init();
+  A_init();
+  B_init();
+
+  start = now(CLOCK_MONOTONIC);
+  armtimer(arrivalfd, lambda*jimsrand()*2);
+
+  /* run until every message accepted by A has been delivered */
+  while (nsim < nsimmax || messages_delivered < nsim - window_full) {
+    n = epoll_wait(epfd, events, 8, IDLETIME);
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n <= 0) {
+      printf("Warning: no activity for %d ms, giving up\n", IDLETIME);
+      break;
+    }
+    for (i=0; i<n; i++) {
+      switch (events[i].data.u32) {
+      case SOCKET_A:
+      case SOCKET_B:
+        receive(events[i].data.u32 == SOCKET_A ? A : B);
+        break;
+      case TIMER_A:
+      case TIMER_B:
+        if (readtimer(timerfd[events[i].data.u32 - TIMER_A]) > 0) {
+          timerrunning[events[i].data.u32 - TIMER_A] = 0;
+          if (events[i].data.u32 == TIMER_A)
+            A_timerinterrupt();
+          else
+            B_timerinterrupt();
+        }
+        break;
+      case LAYER5:
+        arrivals();
+        break;
+      }
+    }
+    flush(A);
+    flush(B);
+  }
+  elapsed = now(CLOCK_MONOTONIC) - start;
+  getrusage(RUSAGE_SELF, &ru);
+  cpu = ru.ru_utime.tv_sec + ru.ru_utime.tv_usec/1e6 + ru.ru_stime.tv_sec + ru.ru_stime.tv_usec/1e6;
+
+  printf(" Run ended after %f seconds\n after attempting to send %d msgs from layer5\n", elapsed, nsim);
+  printf("number of messages dropped due to full window:  %d \n", window_full);
+  printf("number of valid (not corrupt or duplicate) acknowledgements received at A:  %d \n", new_ACKs);
+  printf("number of packet resends by A:  %d \n", packets_resent);
+  if (fast_retransmits > 0)
+    printf("number of packets fast retransmitted by A:  %d \n", fast_retransmits);
+  if (window_probes > 0)
+    printf("number of zero window probes sent by A:  %d \n", window_probes);
+  printf("number of correct packets received at B:  %d \n", packets_received);
+  printf("number of messages delivered to application:  %d \n", messages_delivered);
+  printf("packets sent into layer 3:  %ld (lost %ld, corrupted %ld, refused by socket %ld)\n",
+         ntolayer3, nlost, ncorrupt, nsenderr);
+  printf("datagrams received:  %ld in %ld recvmmsg calls, sent in %ld sendmmsg calls\n",
+         nreceived, nrecvcalls, nsendcalls);
+  printf("packet rate:  %.0f packets/s\n", elapsed > 0 ? nreceived/elapsed : 0.0);
+  printf("CPU time:  %f s, %.3f us per packet\n", cpu, nreceived > 0 ? cpu*1e6/nreceived : 0.0);
+  return EXIT_SUCCESS;
+}